@@ -1,596 +1,5692 @@
-#include <cmath>
-#include <map>
-#include <list>
-#include <string>
-#include <vector>
-#include <numeric>
-#include <iostream>
-#include <sstream>
-#include <unordered_map>
-#include <iterator>
-#include <cstdint>
-#include <stdexcept>
-#include <memory>
-#include <iomanip>
-
-using int32 = std::int32_t;
-using uint32 = std::uint32_t;
-
-enum class Side{
-    Buy,
-    Sell
-};
-
-enum class OrderType{
-    GoodTillFill,
-    FillOrKill
-};
-
-struct PriceLevel{
-    float price;
-    uint32 quantity;
-};
-
-class Order{
-private:
-    OrderType orderType_;
-    Side side_;
-    uint32 orderId_;
-    float price_;
-    uint32 quantity_;
-    uint32 remaining_;
-    bool counted_ = false;
-
-
-public:
-    Order(OrderType orderType, Side side, uint32 orderId, float price, uint32 quantity):
-        orderType_ (orderType),
-        side_ (side),
-        orderId_ (orderId),
-        price_ (price),
-        quantity_ (quantity),
-        remaining_ (quantity)
-        
-        {
-            if(fmod(price_, 0.25) != 0){
-                throw std::logic_error("Price is not an increment of a tick (0.25)");
-            }
-        }
-
-        OrderType getOrderType() const { return orderType_; }
-        Side getSide() const {return side_; }
-        uint32 getOrderId() const { return orderId_; }
-        float getPrice() const { return price_; }
-        uint32 getQuantity() const {return quantity_;}
-        uint32 getRemaining() const { return remaining_; }
-        bool getCounted() const {return counted_; }
-        void toggleCounted() { counted_ = true; }
-
-        void fillOrder(uint32 quantityv){
-            if (quantityv <= getRemaining()){
-                remaining_ -= quantityv;
-            }else {
-                std::cout << "Error fill quantity more than remaining" << std::endl;
-            }
-        }
-};
-
-
-
-using priceLevels = std::vector<PriceLevel>;
-
-class BookLevels{
-private:
-    priceLevels bids_;
-    priceLevels asks_;
-    
-public:
-    BookLevels(const priceLevels& bids, const priceLevels& asks):
-        bids_ (bids),
-        asks_(asks)
-        {}
-        
-        const priceLevels& getBids() const{
-            return bids_;
-        }
-        
-        const priceLevels& getAsks() const{
-            return asks_;
-        }
-
-};
-
-using OrderPointer = std::shared_ptr<Order>;
-using OrderPointers = std::list<OrderPointer>;
-
-struct TradeInfo {
-    uint32 orderId_;
-    float price_;
-    uint32 quantity_;
-
-};
-
-class Trade{
-private:
-    TradeInfo bidSide_;
-    TradeInfo askSide_;
-
-public:
-    Trade(const TradeInfo& bidSide, const TradeInfo& askSide):
-        bidSide_ (bidSide),
-        askSide_ (askSide)
-        {}
-
-        const TradeInfo& getBidSide() const { return bidSide_; }
-        const TradeInfo& getAskSide() const { return askSide_; }
-};
-
-
-
-class Orderbook{
-
-private:
-
-    struct OrderEntry{
-        OrderPointer order_{nullptr};
-        OrderPointers::iterator location_;
-
-
-    };
-
-    struct LevelStat{
-        
-        uint32 volume = 0;
-        uint32 openBids = 0;
-        uint32 openAsks = 0;
-    };
-
-    std::map<float, OrderPointers, std::greater<float>> bids_;
-    std::map<float, OrderPointers, std::less<float>> asks_;
-    std::unordered_map<uint32, OrderEntry> orders_;
-    std::unordered_map<float, LevelStat> levelStats_;
-    std::vector<Trade> trades_;
-    uint32 seqIdx = 0;
-    bool newestIsBuy = false;
-    bool populated_ = false;
-    bool canFill(Side orderSide, float price) const{
-        if (orderSide == Side::Buy ){
-            if (asks_.empty()){
-                return false;
-            }else{
-                    const auto& [bestAsk, temp] = *asks_.begin();
-                    return price >= bestAsk;
-
-
-            }
-
-        }else {
-            if(bids_.empty()){
-                return false;
-            }else{
-                    const auto& [bestBid, temp] = *bids_.begin();
-                    return price <= bestBid; 
-            }
-        }
-    }
-
-    void Fill() {
-        
-
-        while (true){
-
-            
-            auto& [bidPrice, bids] = *bids_.begin();
-            auto& [askPrice, asks] = *asks_.begin();
-            if((bidPrice < askPrice) || (bidPrice == 0 || askPrice == 0)){
-                break;
-            }
-            while(!(bids.empty()) && !(asks.empty())){
-                
-                
-                OrderPointer& bid = bids.front();
-                OrderPointer& ask = asks.front();
-                uint32 bOrdId = bid -> getOrderId();
-                uint32 aOrdId = ask -> getOrderId();
-                std::string bMsg = " partially filled @ ";
-                std::string aMsg = " partially filled @ ";
-                float ordPrice = bidPrice;
-
-                if(newestIsBuy){
-                    ordPrice = askPrice;
-                }
-                uint32 minquantity = std::min(bid -> getRemaining(), ask -> getRemaining());
-                
-                bid -> fillOrder(minquantity);
-                ask -> fillOrder(minquantity);
-                
-                trades_.push_back(Trade{
-                    TradeInfo{ bOrdId, ordPrice, minquantity},
-                    
-                    TradeInfo{aOrdId, ordPrice, minquantity}
-                
-                }); 
-
-                UpdateLevelStats();
-                
-                if (bid -> getRemaining() == 0 || bid -> getOrderType() == OrderType::FillOrKill){
-                    
-                    bMsg = " fully filled @ ";
-                    if (bid -> getOrderType() == OrderType::FillOrKill && bid -> getRemaining() != 0){
-                        bMsg = " partially filled and killed @ ";
-                    }
-                    bids.pop_front();
-                    orders_.erase(bOrdId);
-                   
-                }
-
-
-                
-                if (ask -> getRemaining() == 0|| ask -> getOrderType() == OrderType::FillOrKill ){
-                    
-                    aMsg = " fully filled @ ";
-                    if (ask -> getOrderType() == OrderType::FillOrKill && ask -> getRemaining() != 0){
-                        aMsg = " partially filled and killed @ ";
-                    }
-                    asks.pop_front();
-                    orders_.erase(aOrdId);
-                    
-                    }
-
-                
-                
-                std::cout << "Buy Order# " << bOrdId << bMsg << ordPrice << " for " << minquantity << " units." << std::endl;
-                std::cout << "Sell Order# " << aOrdId << aMsg << ordPrice << " for " << minquantity << " units." << std::endl;
-
-                
-
-            }     
-              
-            if (bids.empty()){
-                bids_.erase(bidPrice);
-            }
-            if (asks.empty()){
-                asks_.erase(askPrice);
-            }
-                
-        }
-
-        
-    }
-
-    void UpdateLevelStats(){
-        
-        for(int i = seqIdx; i < trades_.size(); i++){
-            
-            Trade& currTrade = trades_[i];
-            const TradeInfo& bidSide = currTrade.getBidSide();
-            const TradeInfo& askSide = currTrade.getAskSide();
-            LevelStat& bidLevel = levelStats_[bidSide.price_];
-            LevelStat& askLevel = levelStats_[askSide.price_];
-            OrderPointer& bidOrd = orders_[bidSide.orderId_].order_;
-            OrderPointer& askOrd = orders_[askSide.orderId_].order_;
-
-
-            bidLevel.volume += bidSide.quantity_;
-            
-            
-            if(bidOrd -> getOrderType() != OrderType::FillOrKill && bidOrd -> getRemaining() > 0 && !(bidOrd -> getCounted())){
-                levelStats_[bidOrd -> getPrice()].openBids += bidOrd -> getRemaining();
-                bidOrd -> toggleCounted();
-            } else if(bidOrd -> getCounted()){
-                levelStats_[bidOrd -> getPrice()].openBids -= bidSide.quantity_;
-            }
-            if(askOrd -> getOrderType() != OrderType::FillOrKill && askOrd -> getRemaining() > 0 && !(askOrd -> getCounted())){
-                levelStats_[askOrd -> getPrice()].openAsks += askOrd -> getRemaining();
-                askOrd -> toggleCounted();
-            } else if(askOrd -> getCounted()){
-                levelStats_[askOrd -> getPrice()].openAsks -= askSide.quantity_;
-            }
-            
-
-
-        }
-
-        seqIdx = trades_.size();
-    }
-
-public:
-
-    void AddOrder(OrderPointer ordp){
-        
-        std::cout << "Order# " << ordp -> getOrderId() << " confirmed." << std::endl;
-        if (orders_.find(ordp -> getOrderId()) != orders_.end()){
-            std::cout << ordp -> getOrderId() << std::endl;
-            throw std::logic_error("Order with this order number already exists.");
-        }
-
-
-        if (ordp -> getOrderType() == OrderType::FillOrKill && !(canFill(ordp -> getSide(), ordp -> getPrice())) ){
-            std::cout << "FillorKill Order# " << ordp -> getOrderId() << " could not be filled so it was cancelled." << std::endl;
-            return;
-        }
-
-        OrderPointers::iterator iter;
-
-        if(ordp -> getSide() == Side::Buy){
-            auto& bidlvl = bids_[ordp -> getPrice()];
-            bidlvl.push_back(ordp);
-            iter = std::next(bidlvl.begin(), bidlvl.size() - 1);
-            newestIsBuy = true;
-
-        }else{
-            auto& asklvl = asks_[ordp -> getPrice()];
-            asklvl.push_back(ordp);
-            iter = std::next(asklvl.begin(), asklvl.size()-1);
-            newestIsBuy = false;
-        }
-
-        orders_.insert({ ordp -> getOrderId(), OrderEntry{ordp, iter}});
-        if(canFill(ordp -> getSide(), ordp -> getPrice())){
-             
-            Fill();
-        }else{
-            if(ordp -> getSide() == Side::Buy){
-                levelStats_[ordp ->getPrice()].openBids += ordp -> getQuantity();
-                ordp -> toggleCounted();
-            }else {
-                levelStats_[ordp -> getPrice()].openAsks += ordp -> getQuantity();
-                ordp -> toggleCounted();
-            }
-        }
-        
-        
-
-    }
-
-    void CancelOrder(uint32 ordId){
-        if (orders_.find(ordId) == orders_.end()){
-            return;
-        }
-
-        const auto& [order, iter] = orders_.at(ordId);
-        orders_.erase(ordId);
-
-        if (order -> getSide() == Side::Buy){
-            auto& orderslvl = bids_.at(order -> getPrice());
-            orderslvl.erase(iter);
-            if(orderslvl.empty()){
-                bids_.erase(order -> getPrice());
-            }
-        }else {
-            auto& orderslvl = asks_.at(order -> getPrice());
-            orderslvl.erase(iter);
-            if(orderslvl.empty()){
-                asks_.erase(order -> getPrice());
-            }
-        }
-
-    }
-
-    void PrintDom(){
-        if(bids_.empty() || asks_.empty()){
-            std::cout << "Not enough orders to print a DOM" << std::endl;
-            return;
-        }
-        auto& [bestBid, _]  = *bids_.begin();
-        auto& [bestAsk, __] = *asks_.begin();
-        auto& [highestPrice, ___] = *std::prev(asks_.end());
-        auto& [lowestPrice, ____] = *std::prev(bids_.end()); 
-        float mktPrice = bestBid + (std::round((bestAsk - bestBid))/2.0);
-        std::vector<float> priceLadder;
-        uint32 largerstVol = 0;
-        
-        for(float i = highestPrice; i >= lowestPrice; i -= 0.25){
-            priceLadder.push_back(i);
-        }
-
-       
-
-        for (auto& [_, priceLvl] : levelStats_){
-            if(priceLvl.volume > largerstVol){
-                largerstVol = priceLvl.volume;
-            }
-        }
-
-
-        std::cout << std::setw(10) << std::left << " " << std::setw(20) << std::left << "Volume";
-        std::cout << std::setw(15) << std::left << "Price";
-        std::cout << std::setw(15) << std::left << "Bids" << "Asks" << std::endl;
-
-        for( float i: priceLadder){
-            if (i == mktPrice){
-                std::cout << "\033[1;33m" << std::setw(22) << "" << std::left << "========" << mktPrice << "========" << "\033[0m" << std::endl;
-            }
-            LevelStat& priceLvl = levelStats_[i];
-            uint32 volume = priceLvl.volume;
-            uint32 barsize = 0;
-            
-
-            if (volume != 0){
-                barsize = std::round((static_cast<float>(volume) / largerstVol) * 25);
-            }
-
-            std::cout << std::setw(5) << std::left << priceLvl.volume << std::setw(25 - barsize) << "";
-            for(int i = 0; i < barsize; i++){
-                std::cout << "\033[1;34m" << "\u2588" << "\033[0m";
-            }
-            std::cout << std::setw(15) << std::left << i;
-            std::cout << "\033[1;32m" << std::setw(15) << std::left;
-            if(priceLvl.openBids){
-                std::cout << priceLvl.openBids << "\033[0m";
-            }else{
-                std::cout << "" << "\033[0m";
-            }
-            if(priceLvl.openAsks){
-                std::cout << "\033[1;31m" << priceLvl.openAsks << "\033[0m";
-            }
-            std::cout << std::endl;
-
-
-        }
-
-    }
-
-    void ParseMessage(std::string msg){
-
-        std::vector<std::string> seperated;
-        std::string temp;
-        std::stringstream ss(msg);
-        std::string f35;
-        uint32 f11;
-        uint16_t f21;
-        uint16_t f54;
-        uint32  f38;
-        float f44;
-        OrderType ordT;
-        Side ordS;
-
-        while (std::getline(ss, temp, '|')){
-            seperated.push_back(temp);
-        }
-
-        if(seperated.size() != 16){
-            std::cout << "Not a valid FIX order" << std::endl;
-            return;
-        }
-
-        f35 = seperated[2].substr(3);
-        f11 = std::stoi(seperated[7].substr(3));
-        f21 =std::stoi(seperated[8].substr(3));
-        f54 = std::stoi(seperated[10].substr(3));
-        f38 = std::stoi(seperated[11].substr(3));
-        f44 = std::stof(seperated[13].substr(3));
-        std::cout << f21 << std::endl;
-        if(f35 != "D"){
-            std::cout << "This orderbook only accepts single order messages. (35)" << std::endl;
-            return;
-        }
-
-        if(f21 == 1){
-            ordT = OrderType::FillOrKill;
-        } else if(f21 == 2){
-            ordT = OrderType::GoodTillFill;
-        }else{
-            std::cout << "Invalid order type. (21)" << std::endl;
-            return;
-        }
-
-        if(f54 == 1){
-            ordS = Side::Buy;
-        }else if(f54 == 2){
-            ordS = Side::Sell;
-        }else{
-            std::cout << "Invalid order side. (54)" << std::endl;
-        }
-
-        AddOrder(std::make_shared<Order>(ordT, ordS, f11, f44, f38));
-
-    }
-
-    void populateOrderBook(){
-        if(populated_){
-            std::cout << "Ourderbook has already been populated" << std::endl;
-            return;
-        }
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  10000,  98.00, 30));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 20000,  98.00, 30)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  30000,  98.25, 20));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 40000,  98.25, 20)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  50000,  98.50, 40));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 60000,  98.50, 40)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  70000,  98.75, 35));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 80000,  98.75, 35)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  90000,  99.00, 50));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 100000, 99.00, 50)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  110000, 99.25, 25));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 120000, 99.25, 25)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  130000, 99.50, 45));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 140000, 99.50, 45)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  150000, 99.75, 55));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 160000, 99.75, 55)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  170000, 100.00, 60));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 180000, 100.00, 60)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  190000, 100.25, 50));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 200000, 100.25, 50)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  210000, 100.50, 40));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 220000, 100.50, 40)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  203000, 100.75, 35));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 240000, 100.75, 35)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  250000, 101.00, 30));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 260000, 101.00, 30)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  270000, 101.25, 25));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 280000, 101.25, 25)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  290000, 101.50, 20));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 300000, 101.50, 20)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  310000, 101.75, 15));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 320000, 101.75, 15)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  330000, 102.00, 10));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 340000, 102.00, 10)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  350000, 102.25, 5));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  10001,  99,  50));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  20001,  99.25, 40));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  30001,  99.50, 60));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  40001,  99.75, 70));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  50001,  100.00, 10));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  60001,  100.00, 5));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  70001,  100.25, 30));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  80001,  100.50, 20));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  90001,  100.75, 10));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 100001, 100.50, 80)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 110001, 100.25, 90)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 120001, 100.00, 80)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 130001, 100.75, 10));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 140001, 101.00, 50));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 150001, 101.25, 40));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 160001, 101.50, 60));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 170001, 101.75, 70));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 180001, 102.00, 80));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  190001, 98.75, 20));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  200001, 98.50, 30));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  210001, 98.25, 40));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  220001, 98.00, 50));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 230001, 102.25, 40));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 240001, 102.50, 30));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 250001, 102.75, 20));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 260001, 103.00, 10));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  270001, 99.00, 35));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 280001, 101.75, 25));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  290001, 99.50, 45));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 300001, 100.75, 15));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  330001, 99.75, 25));
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Sell, 340001, 99.75, 25)); 
-        AddOrder(std::make_shared<Order>(OrderType::GoodTillFill, Side::Buy,  350001, 99.25, 30));
-        populated_ = true;
-    }
-};
-
-int main()
-{
-    Orderbook orderbook;
-    while(true){
-    std::string input;
-    
-    std::cout << "C++ Orderbook and Visual DOM" << std::endl;
-    std::cout << "============================" << std::endl;
-    std::cout << "1. Submit Order" << std::endl;
-    std::cout << "2. Print Visual DOM" << std::endl;
-    std::cout << "3. Populate Orderbook" << std::endl;
-    std::getline(std::cin, input);
-
-    if(input == "1"){
-        std::string order;
-        std::cout << "Enter your order" << std::endl; 
-        std::getline(std::cin, order);
-        orderbook.ParseMessage(order);
-    }else if(input == "2"){
-        orderbook.PrintDom();
-    }else if(input == "3"){
-        orderbook.populateOrderBook();
-    }else{
-        std::cout << "Invalid Input" << std::endl;
-        
-    }
-    
-    }
-    return 0;
-}
+#include <cmath>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include <iterator>
+#include <cstdint>
+#include <stdexcept>
+#include <cassert>
+#include <iomanip>
+#include <array>
+#include <algorithm>
+#include <limits>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <functional>
+#include <utility>
+#include <unordered_map>
+#include <memory>
+#include <charconv>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using int32 = std::int32_t;
+using uint32 = std::uint32_t;
+using uint64 = std::uint64_t;
+using int64 = std::int64_t;
+using Tick = int32;
+using OrderHandle = uint32;
+
+constexpr OrderHandle nullHandle = std::numeric_limits<OrderHandle>::max();
+
+enum class Side{
+    Buy,
+    Sell
+};
+
+enum class OrderType{
+    GoodTillFill,
+    FillOrKill,
+    ImmediateOrCancel
+};
+
+// A stop order waits off the book until a trade prints at or through its stop price, then
+// enters as a market order (Stop) or as a limit order at its own price (StopLimit).
+enum class StopType{
+    None,
+    Stop,
+    StopLimit
+};
+
+constexpr Side opposite(Side side){ return side == Side::Buy ? Side::Sell : Side::Buy; }
+
+struct PriceLevel{
+    Tick price;
+    uint32 quantity;
+};
+
+class Order{
+private:
+    OrderType orderType_ = OrderType::GoodTillFill;
+    Side side_ = Side::Buy;
+    uint32 orderId_ = 0;
+    Tick price_ = 0;
+    uint32 quantity_ = 0;
+    uint32 remaining_ = 0;
+    StopType stopType_ = StopType::None;
+    Tick stopPrice_ = 0;
+    uint32 session_ = 0;
+    OrderHandle prev_ = nullHandle;
+    OrderHandle next_ = nullHandle;
+
+    friend class OrderPool;
+
+public:
+    Order() = default;
+
+    static Order fromTicks(OrderType orderType, Side side, uint32 orderId, Tick price, uint32 quantity){
+        Order order;
+        order.orderType_ = orderType;
+        order.side_ = side;
+        order.orderId_ = orderId;
+        order.price_ = price;
+        order.quantity_ = quantity;
+        order.remaining_ = quantity;
+        return order;
+    }
+
+        OrderType getOrderType() const { return orderType_; }
+        Side getSide() const {return side_; }
+        uint32 getOrderId() const { return orderId_; }
+        Tick getPrice() const { return price_; }
+        uint32 getQuantity() const {return quantity_;}
+        uint32 getRemaining() const { return remaining_; }
+        uint32 getFilled() const { return quantity_ - remaining_; }
+        StopType getStopType() const { return stopType_; }
+        Tick getStopPrice() const { return stopPrice_; }
+        bool isStop() const { return stopType_ != StopType::None; }
+        uint32 getSession() const { return session_; }
+
+        void setStop(StopType stopType, Tick stopPrice){
+            stopType_ = stopType;
+            stopPrice_ = stopPrice;
+        }
+
+        void setSession(uint32 session){
+            session_ = session;
+        }
+
+        void amend(uint32 orderId, Tick price, uint32 quantity){
+            remaining_ = quantity - getFilled();
+            orderId_ = orderId;
+            price_ = price;
+            quantity_ = quantity;
+        }
+
+        // Takes quantity off the order without filling it.
+        void reduce(uint32 quantity){
+            quantity_ -= quantity;
+            remaining_ -= quantity;
+        }
+
+        // Matching clamps every fill to what both sides have left, so overfilling is a bug.
+        void fillOrder(uint32 quantity){
+            assert(quantity <= remaining_);
+            remaining_ -= quantity;
+        }
+};
+
+
+
+using priceLevels = std::vector<PriceLevel>;
+
+class BookLevels{
+private:
+    priceLevels bids_;
+    priceLevels asks_;
+    uint64 sequence_;
+    
+public:
+    BookLevels(const priceLevels& bids, const priceLevels& asks, uint64 sequence = 0):
+        bids_ (bids),
+        asks_(asks),
+        sequence_ (sequence)
+        {}
+        
+        uint64 getSequence() const { return sequence_; }
+        
+        const priceLevels& getBids() const{
+            return bids_;
+        }
+        
+        const priceLevels& getAsks() const{
+            return asks_;
+        }
+
+};
+
+struct OrderQueue{
+    OrderHandle head = nullHandle;
+    OrderHandle tail = nullHandle;
+
+    bool empty() const { return head == nullHandle; }
+};
+
+// Fixed slab of orders handed out by index. Free slots are chained through next_, and live
+// orders are chained through prev_/next_ into the FIFO of their price level.
+class OrderPool{
+private:
+    std::vector<Order> slots_;
+    OrderHandle freeHead_ = nullHandle;
+    uint32 used_ = 0;
+
+public:
+    explicit OrderPool(uint32 capacity):
+        slots_ (capacity)
+        {
+            for(uint32 i = capacity; i > 0; i--){
+                slots_[i - 1].next_ = freeHead_;
+                freeHead_ = i - 1;
+            }
+        }
+
+        uint32 size() const { return used_; }
+        uint32 capacity() const { return static_cast<uint32>(slots_.size()); }
+        Order& operator[](OrderHandle handle) { return slots_[handle]; }
+        const Order& operator[](OrderHandle handle) const { return slots_[handle]; }
+        OrderHandle next(OrderHandle handle) const { return slots_[handle].next_; }
+
+        OrderHandle allocate(const Order& order){
+            if(freeHead_ == nullHandle){
+                return nullHandle;
+            }
+            OrderHandle handle = freeHead_;
+            freeHead_ = slots_[handle].next_;
+            slots_[handle] = order;
+            slots_[handle].prev_ = nullHandle;
+            slots_[handle].next_ = nullHandle;
+            used_++;
+            return handle;
+        }
+
+        void release(OrderHandle handle){
+            slots_[handle].next_ = freeHead_;
+            freeHead_ = handle;
+            used_--;
+        }
+
+        void pushBack(OrderQueue& queue, OrderHandle handle){
+            slots_[handle].prev_ = queue.tail;
+            slots_[handle].next_ = nullHandle;
+            if(queue.tail == nullHandle){
+                queue.head = handle;
+            }else{
+                slots_[queue.tail].next_ = handle;
+            }
+            queue.tail = handle;
+        }
+
+        void unlink(OrderQueue& queue, OrderHandle handle){
+            Order& order = slots_[handle];
+            if(order.prev_ == nullHandle){
+                queue.head = order.next_;
+            }else{
+                slots_[order.prev_].next_ = order.next_;
+            }
+            if(order.next_ == nullHandle){
+                queue.tail = order.prev_;
+            }else{
+                slots_[order.next_].prev_ = order.prev_;
+            }
+            order.prev_ = nullHandle;
+            order.next_ = nullHandle;
+        }
+};
+
+// Open-addressed orderId -> handle table sized for twice the pool, so it never grows or
+// rehashes. Erase uses backward shifting, which keeps probe chains short without tombstones.
+class OrderIndex{
+private:
+    struct Slot{
+        uint32 orderId = 0;
+        OrderHandle handle = nullHandle;
+    };
+
+    std::vector<Slot> slots_;
+    uint32 mask_ = 0;
+    uint32 shift_ = 64;
+
+    uint32 home(uint32 orderId) const {
+        return static_cast<uint32>((orderId * 0x9E3779B97F4A7C15ull) >> shift_);
+    }
+
+    uint32 probe(uint32 orderId) const {
+        uint32 idx = home(orderId);
+        while(slots_[idx].handle != nullHandle && slots_[idx].orderId != orderId){
+            idx = (idx + 1) & mask_;
+        }
+        return idx;
+    }
+
+public:
+    explicit OrderIndex(uint32 capacity){
+        uint32 bits = 1;
+        while((1ull << bits) < 2ull * capacity){
+            bits++;
+        }
+        slots_.resize(1ull << bits);
+        mask_ = static_cast<uint32>(slots_.size() - 1);
+        shift_ = 64 - bits;
+    }
+
+    OrderHandle find(uint32 orderId) const {
+        return slots_[probe(orderId)].handle;
+    }
+
+    void insert(uint32 orderId, OrderHandle handle){
+        slots_[probe(orderId)] = Slot{orderId, handle};
+    }
+
+    void erase(uint32 orderId){
+        uint32 hole = probe(orderId);
+        if(slots_[hole].handle == nullHandle){
+            return;
+        }
+        uint32 idx = hole;
+        while(true){
+            idx = (idx + 1) & mask_;
+            if(slots_[idx].handle == nullHandle){
+                break;
+            }
+            uint32 want = home(slots_[idx].orderId);
+            if(((idx - want) & mask_) >= ((idx - hole) & mask_)){
+                slots_[hole] = slots_[idx];
+                hole = idx;
+            }
+        }
+        slots_[hole] = Slot{};
+    }
+};
+
+struct Trade{
+    uint64 time;
+    Tick price;
+    uint32 quantity;
+    uint32 buyOrderId;
+    uint32 sellOrderId;
+    Side aggressor;
+};
+
+// Selects trades with fromTime <= time <= toTime and lowPrice <= price <= highPrice.
+struct TradeQuery{
+    uint64 fromTime = 0;
+    uint64 toTime = std::numeric_limits<uint64>::max();
+    Tick lowPrice = std::numeric_limits<Tick>::min();
+    Tick highPrice = std::numeric_limits<Tick>::max();
+};
+
+struct TradeSummary{
+    uint64 trades = 0;
+    uint64 volume = 0;
+    int64 notional = 0;
+
+    // Volume weighted average price, in price units.
+    double getVwap(int32 perPoint) const { return volume == 0 ? 0.0 : static_cast<double>(notional) / volume / perPoint; }
+};
+
+// Trade history kept as columns. The most recent trades live in a fixed ring; when it fills
+// up the oldest quarter is either spilled to disk as one compressed block or dropped if no
+// spill file is set. Spilling is double buffered like the Journal: record() copies the
+// evicted quarter into a preallocated staging set and a background thread compresses and
+// writes it, so the thread that records trades never makes a system call. A quarter that
+// is evicted while the previous one is still staged is dropped and counted. Each spilled
+// block keeps its time/price bounds and totals in memory, so queries only read back blocks
+// they partly overlap. Queries wait for pending blocks to be written first.
+class TradeStore{
+private:
+    struct Block{
+        uint64 firstTime;
+        uint64 lastTime;
+        Tick lowPrice;
+        Tick highPrice;
+        uint32 count;
+        uint32 bytes;
+        uint64 offset;
+        uint64 volume;
+        int64 notional;
+    };
+
+    struct Columns{
+        std::vector<uint64> times;
+        std::vector<Tick> prices;
+        std::vector<uint32> quantities;
+        std::vector<uint32> buyOrderIds;
+        std::vector<uint32> sellOrderIds;
+        std::vector<unsigned char> aggressors;
+        uint32 count = 0;
+
+        void resize(uint64 size){
+            times.resize(size);
+            prices.resize(size);
+            quantities.resize(size);
+            buyOrderIds.resize(size);
+            sellOrderIds.resize(size);
+            aggressors.resize(size);
+        }
+    };
+
+    Columns ring_;
+    uint64 mask_;
+    uint64 count_ = 0;
+    uint64 firstResident_ = 0;
+    uint64 dropped_ = 0;
+    uint32 blockSize_;
+    int fd_ = -1;
+
+    // Shared with the spill thread and guarded by mutex_.
+    Columns staged_;
+    bool stagedFull_ = false;
+    bool writing_ = false;
+    bool stopping_ = false;
+    uint64 lost_ = 0;
+    uint64 fileSize_ = 0;
+    std::vector<Block> blocks_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    mutable std::condition_variable idle_;
+    std::thread spiller_;
+
+    // Owned by the spill thread.
+    Columns spilling_;
+    std::vector<unsigned char> encoded_;
+
+    static void putVarint(std::vector<unsigned char>& out, uint64 value){
+        while(value >= 0x80){
+            out.push_back(static_cast<unsigned char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<unsigned char>(value));
+    }
+
+    static uint64 getVarint(const unsigned char*& in){
+        uint64 value = 0;
+        for(int shift = 0; ; shift += 7){
+            unsigned char byte = *in++;
+            value |= static_cast<uint64>(byte & 0x7f) << shift;
+            if(byte < 0x80){
+                return value;
+            }
+        }
+    }
+
+    static uint64 zigzag(int64 value){ return (static_cast<uint64>(value) << 1) ^ static_cast<uint64>(value >> 63); }
+    static int64 unzigzag(uint64 value){ return static_cast<int64>(value >> 1) ^ -static_cast<int64>(value & 1); }
+
+    Trade at(uint64 seq) const {
+        uint64 i = seq & mask_;
+        return Trade{ring_.times[i], ring_.prices[i], ring_.quantities[i], ring_.buyOrderIds[i], ring_.sellOrderIds[i],
+            ring_.aggressors[i] == 0 ? Side::Buy : Side::Sell};
+    }
+
+    static bool matches(const TradeQuery& query, uint64 time, Tick price){
+        return time >= query.fromTime && time <= query.toTime && price >= query.lowPrice && price <= query.highPrice;
+    }
+
+    static bool overlaps(const TradeQuery& query, const Block& block){
+        return block.lastTime >= query.fromTime && block.firstTime <= query.toTime
+            && block.highPrice >= query.lowPrice && block.lowPrice <= query.highPrice;
+    }
+
+    static bool covers(const TradeQuery& query, const Block& block){
+        return block.firstTime >= query.fromTime && block.lastTime <= query.toTime
+            && block.lowPrice >= query.lowPrice && block.highPrice <= query.highPrice;
+    }
+
+    // Hands the oldest count trades of the ring to the spill thread. Returns false if it is
+    // still busy with the previous block.
+    bool Stage(uint64 first, uint32 count){
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(stagedFull_){
+                return false;
+            }
+            uint64 begin = first & mask_;
+            auto copy = [&](const auto& from, auto& to){
+                std::copy(from.begin() + begin, from.begin() + begin + count, to.begin());
+            };
+            copy(ring_.times, staged_.times);
+            copy(ring_.prices, staged_.prices);
+            copy(ring_.quantities, staged_.quantities);
+            copy(ring_.buyOrderIds, staged_.buyOrderIds);
+            copy(ring_.sellOrderIds, staged_.sellOrderIds);
+            copy(ring_.aggressors, staged_.aggressors);
+            staged_.count = count;
+            stagedFull_ = true;
+        }
+        wake_.notify_one();
+        return true;
+    }
+
+    // Each column is written in turn: times, prices and order ids as zigzag deltas from the
+    // previous trade, quantities as plain varints and aggressor sides as one bit per trade.
+    void Encode(const Columns& trades, Block& block){
+        encoded_.clear();
+        uint32 count = trades.count;
+        block = Block{std::numeric_limits<uint64>::max(), 0, std::numeric_limits<Tick>::max(), std::numeric_limits<Tick>::min(), count, 0, 0, 0, 0};
+        int64 previous = 0;
+        for(uint32 i = 0; i < count; i++){
+            uint64 time = trades.times[i];
+            putVarint(encoded_, zigzag(static_cast<int64>(time) - previous));
+            previous = static_cast<int64>(time);
+            block.firstTime = std::min(block.firstTime, time);
+            block.lastTime = std::max(block.lastTime, time);
+        }
+        previous = 0;
+        for(uint32 i = 0; i < count; i++){
+            Tick price = trades.prices[i];
+            uint32 quantity = trades.quantities[i];
+            putVarint(encoded_, zigzag(price - previous));
+            previous = price;
+            block.lowPrice = std::min(block.lowPrice, price);
+            block.highPrice = std::max(block.highPrice, price);
+            block.volume += quantity;
+            block.notional += static_cast<int64>(price) * quantity;
+        }
+        for(uint32 i = 0; i < count; i++){
+            putVarint(encoded_, trades.quantities[i]);
+        }
+        for(const std::vector<uint32>* ids : {&trades.buyOrderIds, &trades.sellOrderIds}){
+            previous = 0;
+            for(uint32 i = 0; i < count; i++){
+                uint32 id = (*ids)[i];
+                putVarint(encoded_, zigzag(static_cast<int64>(id) - previous));
+                previous = id;
+            }
+        }
+        size_t sides = encoded_.size();
+        encoded_.resize(sides + (count + 7) / 8, 0);
+        for(uint32 i = 0; i < count; i++){
+            encoded_[sides + i / 8] |= static_cast<unsigned char>(trades.aggressors[i] << (i % 8));
+        }
+        block.bytes = static_cast<uint32>(encoded_.size());
+    }
+
+    bool Write(uint64 offset){
+        size_t written = 0;
+        while(written < encoded_.size()){
+            ssize_t n = ::pwrite(fd_, encoded_.data() + written, encoded_.size() - written, static_cast<off_t>(offset + written));
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n <= 0){
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // The spill thread sleeps until a block is staged, swaps it out so record() can stage the
+    // next one, then compresses and writes it outside the lock.
+    void Spill(){
+        std::unique_lock<std::mutex> lock(mutex_);
+        while(true){
+            wake_.wait(lock, [&](){ return stopping_ || stagedFull_; });
+            if(!stagedFull_){
+                return;
+            }
+            std::swap(staged_, spilling_);
+            stagedFull_ = false;
+            writing_ = true;
+            uint64 offset = fileSize_;
+            lock.unlock();
+            Block block;
+            Encode(spilling_, block);
+            block.offset = offset;
+            bool written = Write(offset);
+            lock.lock();
+            if(written){
+                fileSize_ += block.bytes;
+                blocks_.push_back(block);
+            }else{
+                lost_ += block.count;
+            }
+            writing_ = false;
+            idle_.notify_all();
+        }
+    }
+
+    void StopSpilling(){
+        if(spiller_.joinable()){
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_one();
+            spiller_.join();
+            stopping_ = false;
+        }
+        if(fd_ >= 0){
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    void Load(const Block& block, std::vector<Trade>& out) const {
+        std::vector<unsigned char> bytes(block.bytes);
+        if(::pread(fd_, bytes.data(), bytes.size(), static_cast<off_t>(block.offset)) != static_cast<ssize_t>(bytes.size())){
+            out.clear();
+            return;
+        }
+        out.resize(block.count);
+        const unsigned char* in = bytes.data();
+        int64 previous = 0;
+        for(Trade& trade : out){
+            previous += unzigzag(getVarint(in));
+            trade.time = static_cast<uint64>(previous);
+        }
+        previous = 0;
+        for(Trade& trade : out){
+            previous += unzigzag(getVarint(in));
+            trade.price = static_cast<Tick>(previous);
+        }
+        for(Trade& trade : out){
+            trade.quantity = static_cast<uint32>(getVarint(in));
+        }
+        previous = 0;
+        for(Trade& trade : out){
+            previous += unzigzag(getVarint(in));
+            trade.buyOrderId = static_cast<uint32>(previous);
+        }
+        previous = 0;
+        for(Trade& trade : out){
+            previous += unzigzag(getVarint(in));
+            trade.sellOrderId = static_cast<uint32>(previous);
+        }
+        for(uint32 i = 0; i < block.count; i++){
+            out[i].aggressor = (in[i / 8] >> (i % 8)) & 1 ? Side::Sell : Side::Buy;
+        }
+    }
+
+public:
+    static constexpr uint32 defaultCapacity = 1 << 16;
+
+    explicit TradeStore(uint32 capacity = defaultCapacity){
+        uint64 size = 8;
+        while(size < capacity){
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        blockSize_ = static_cast<uint32>(size / 4);
+        ring_.resize(size);
+    }
+
+        ~TradeStore(){
+            StopSpilling();
+        }
+
+        TradeStore(const TradeStore&) = delete;
+        TradeStore& operator=(const TradeStore&) = delete;
+
+        // Starts spilling evicted trades to a fresh file instead of dropping them. The staging
+        // buffers are allocated here, so recording never allocates.
+        bool spillTo(const char* path){
+            StopSpilling();
+            fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            fileSize_ = 0;
+            blocks_.clear();
+            if(fd_ < 0){
+                return false;
+            }
+            staged_.resize(blockSize_);
+            spilling_.resize(blockSize_);
+            encoded_.reserve(size_t(blockSize_) * 32);
+            spiller_ = std::thread([this](){ Spill(); });
+            return true;
+        }
+
+        uint64 size() const { return count_; }
+        uint64 getResident() const { return count_ - firstResident_; }
+
+        // Trades evicted to the spill file, including a block still being written.
+        uint64 getSpilled() const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return firstResident_ - dropped_ - lost_;
+        }
+
+        uint64 getDropped() const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return dropped_ + lost_;
+        }
+
+        uint64 getSpillBytes() const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return fileSize_;
+        }
+
+        // Blocks until every staged block is on disk or lost. Queries call it first; they run
+        // on the recording thread, so nothing new is staged while they read blocks_.
+        void flush() const {
+            std::unique_lock<std::mutex> lock(mutex_);
+            idle_.wait(lock, [&](){ return !stagedFull_ && !writing_; });
+        }
+
+        void record(uint64 time, Tick price, uint32 quantity, uint32 buyOrderId, uint32 sellOrderId, Side aggressor){
+            if(count_ - firstResident_ > mask_){
+                if(fd_ < 0 || !Stage(firstResident_, blockSize_)){
+                    dropped_ += blockSize_;
+                }
+                firstResident_ += blockSize_;
+            }
+            uint64 i = count_ & mask_;
+            ring_.times[i] = time;
+            ring_.prices[i] = price;
+            ring_.quantities[i] = quantity;
+            ring_.buyOrderIds[i] = buyOrderId;
+            ring_.sellOrderIds[i] = sellOrderId;
+            ring_.aggressors[i] = aggressor == Side::Buy ? 0 : 1;
+            count_++;
+        }
+
+        // Visits every retained trade matching the query, oldest first.
+        template<typename Visitor>
+        void forEach(const TradeQuery& query, Visitor&& visit) const {
+            flush();
+            std::vector<Trade> scratch;
+            for(const Block& block : blocks_){
+                if(!overlaps(query, block)){
+                    continue;
+                }
+                Load(block, scratch);
+                for(const Trade& trade : scratch){
+                    if(matches(query, trade.time, trade.price)){
+                        visit(trade);
+                    }
+                }
+            }
+            for(uint64 seq = firstResident_; seq < count_; seq++){
+                uint64 i = seq & mask_;
+                if(matches(query, ring_.times[i], ring_.prices[i])){
+                    visit(at(seq));
+                }
+            }
+        }
+
+        TradeSummary summarise(const TradeQuery& query) const {
+            flush();
+            TradeSummary summary;
+            auto add = [&](const Trade& trade){
+                summary.trades++;
+                summary.volume += trade.quantity;
+                summary.notional += static_cast<int64>(trade.price) * trade.quantity;
+            };
+            std::vector<Trade> scratch;
+            for(const Block& block : blocks_){
+                if(covers(query, block)){
+                    summary.trades += block.count;
+                    summary.volume += block.volume;
+                    summary.notional += block.notional;
+                }else if(overlaps(query, block)){
+                    Load(block, scratch);
+                    for(const Trade& trade : scratch){
+                        if(matches(query, trade.time, trade.price)){
+                            add(trade);
+                        }
+                    }
+                }
+            }
+            for(uint64 seq = firstResident_; seq < count_; seq++){
+                uint64 i = seq & mask_;
+                if(matches(query, ring_.times[i], ring_.prices[i])){
+                    add(at(seq));
+                }
+            }
+            return summary;
+        }
+
+        // Traded volume per price over the query, lowest price first.
+        std::vector<PriceLevel> volumeByPrice(const TradeQuery& query) const {
+            std::vector<PriceLevel> levels;
+            std::unordered_map<Tick, uint32> volume;
+            forEach(query, [&](const Trade& trade){
+                volume[trade.price] += trade.quantity;
+            });
+            levels.reserve(volume.size());
+            for(const auto& [price, quantity] : volume){
+                levels.push_back(PriceLevel{price, quantity});
+            }
+            std::sort(levels.begin(), levels.end(), [](const PriceLevel& a, const PriceLevel& b){ return a.price < b.price; });
+            return levels;
+        }
+};
+
+
+enum class ExecType{
+    Ack,
+    Fill,
+    Kill,
+    Cancel,
+    Replace,
+    Trigger,
+    MassCancel,
+    SelfTrade,
+    Reject
+};
+
+enum class RejectReason{
+    None,
+    DuplicateOrderId,
+    UnknownOrderId,
+    PriceOutOfRange,
+    PoolExhausted,
+    MalformedMessage,
+    BadBodyLength,
+    BadCheckSum,
+    UnsupportedMsgType,
+    InvalidOrderType,
+    InvalidSide,
+    InvalidQuantity,
+    InvalidPrice,
+    InvalidSymbol,
+    PriceOutsideBand,
+    QuantityTooLarge,
+    RiskOrderSize,
+    RiskOpenQuantity,
+    RiskPriceDistance,
+    JournalFailed
+};
+
+struct ExecutionReport{
+    ExecType type;
+    RejectReason reason;
+    Side side;
+    uint32 orderId;
+    Tick price;
+    uint32 quantity;
+    uint32 leaves;
+    OrderType orderType;
+    StopType stopType;
+};
+
+enum class DepthAction{
+    Add,
+    Update,
+    Delete
+};
+
+struct DepthUpdate{
+    uint64 sequence;
+    Tick price;
+    uint32 quantity;
+    Side side;
+    DepthAction action;
+};
+
+// Preallocated FIFO of events. The book only ever pushes into it, the caller drains it
+// whenever it likes. Events that arrive while it is full are counted and dropped.
+template<typename T>
+class EventRing{
+private:
+    std::vector<T> slots_;
+    uint64 head_ = 0;
+    uint64 tail_ = 0;
+    uint64 dropped_ = 0;
+    std::function<void(const T&)> overflow_;
+
+public:
+    explicit EventRing(uint32 capacity):
+        slots_ (capacity)
+        {}
+
+        bool empty() const { return head_ == tail_; }
+        uint64 size() const { return tail_ - head_; }
+        uint64 getDropped() const { return dropped_; }
+
+        // With an overflow handler a full ring hands its oldest event to the handler instead of
+        // dropping the new one, so a consumer that drains into the same place sees every event
+        // in order. The handler must not push back into the ring. Returns the previous handler.
+        std::function<void(const T&)> setOverflow(std::function<void(const T&)> overflow){
+            return std::exchange(overflow_, std::move(overflow));
+        }
+
+        void push(const T& event){
+            if(size() == slots_.size()){
+                if(!overflow_){
+                    dropped_++;
+                    return;
+                }
+                overflow_(slots_[head_++ % slots_.size()]);
+            }
+            slots_[tail_++ % slots_.size()] = event;
+        }
+
+        bool pop(T& event){
+            if(empty()){
+                return false;
+            }
+            event = slots_[head_++ % slots_.size()];
+            return true;
+        }
+};
+
+struct Symbol{
+    static constexpr uint32 maxLength = 15;
+    char name[maxLength + 1] = {};
+
+    std::string_view view() const { return std::string_view(name); }
+    bool empty() const { return name[0] == 0; }
+};
+
+// Decimal price straight to ticks, without going through float. Fails if the price has
+// more than 9 decimals or does not land exactly on a tick.
+inline bool parseTicks(std::string_view text, Tick& out, int32 perPoint){
+    bool negative = !text.empty() && text.front() == '-';
+    if(negative){
+        text.remove_prefix(1);
+    }
+    if(text.empty()){
+        return false;
+    }
+    int64_t whole = 0;
+    int64_t frac = 0;
+    int64_t scale = 1;
+    bool inFraction = false;
+    for(char c : text){
+        if(c == '.' && !inFraction){
+            inFraction = true;
+        }else if(c >= '0' && c <= '9'){
+            if(inFraction){
+                if(scale == 1000000000){
+                    return false;
+                }
+                frac = frac * 10 + (c - '0');
+                scale *= 10;
+            }else{
+                whole = whole * 10 + (c - '0');
+                if(whole > std::numeric_limits<Tick>::max() / perPoint){
+                    return false;
+                }
+            }
+        }else{
+            return false;
+        }
+    }
+    if((frac * perPoint) % scale != 0){
+        return false;
+    }
+    Tick ticks = static_cast<Tick>(whole * perPoint + frac * perPoint / scale);
+    out = negative ? -ticks : ticks;
+    return true;
+}
+
+// Trading rules of one instrument. The tick size is held as a whole number of ticks per
+// point (4 for 0.25, 64 for 1/64), so converting and validating prices is integer multiply
+// and compare. Bands and the size limit are in ticks and units and are open by default.
+struct ContractSpec{
+    Symbol symbol;
+    int32 ticksPerPoint = 4;
+    Tick lowBand = std::numeric_limits<Tick>::min();
+    Tick highBand = std::numeric_limits<Tick>::max();
+    uint32 maxQuantity = std::numeric_limits<uint32>::max();
+    // Resting orders the instrument's book has room for; 0 leaves it to the engine default.
+    uint32 orderCapacity = 0;
+
+    RejectReason check(Tick price, uint32 quantity) const {
+        if(quantity > maxQuantity){
+            return RejectReason::QuantityTooLarge;
+        }
+        if(price < lowBand || price > highBand){
+            return RejectReason::PriceOutsideBand;
+        }
+        return RejectReason::None;
+    }
+
+    double toPrice(Tick price) const { return static_cast<double>(price) / ticksPerPoint; }
+    uint32 bookCapacity(uint32 fallback) const { return orderCapacity != 0 ? orderCapacity : fallback; }
+
+    bool parseTicks(std::string_view text, Tick& out) const { return ::parseTicks(text, out, ticksPerPoint); }
+
+    // Exact decimal text of a price with trailing zeros dropped, e.g. 98.25 or 110.015625.
+    // A tick that is not a power-of-ten fraction of a point falls back to %g.
+    std::string_view format(Tick price, char (&out)[32]) const {
+        int64 ticks = price;
+        char* at = out;
+        if(ticks < 0){
+            *at++ = '-';
+            ticks = -ticks;
+        }
+        at = std::to_chars(at, out + sizeof(out), ticks / ticksPerPoint).ptr;
+        int64 remainder = ticks % ticksPerPoint;
+        if(remainder != 0){
+            int64 scale = 10;
+            uint32 digits = 1;
+            while(scale % ticksPerPoint != 0 && digits < 9){
+                scale *= 10;
+                digits++;
+            }
+            if(scale % ticksPerPoint != 0){
+                int n = std::snprintf(out, sizeof(out), "%g", toPrice(price));
+                return std::string_view(out, static_cast<size_t>(n));
+            }
+            int64 fraction = remainder * (scale / ticksPerPoint);
+            *at++ = '.';
+            for(uint32 i = digits; i-- > 0;){
+                at[i] = static_cast<char>('0' + fraction % 10);
+                fraction /= 10;
+            }
+            at += digits;
+            while(at[-1] == '0'){
+                at--;
+            }
+        }
+        return std::string_view(out, static_cast<size_t>(at - out));
+    }
+};
+
+inline const ContractSpec defaultContract{};
+
+// Contract specs by symbol, with a fallback spec for every symbol that has none. There are
+// only ever a handful, so lookups scan; the table is read-only once matching starts.
+class ContractTable{
+private:
+    std::vector<ContractSpec> specs_;
+    ContractSpec fallback_;
+
+public:
+    // A later spec for the same symbol replaces the earlier one.
+    void add(const ContractSpec& spec){
+        for(ContractSpec& known : specs_){
+            if(known.symbol.view() == spec.symbol.view()){
+                known = spec;
+                return;
+            }
+        }
+        specs_.push_back(spec);
+    }
+
+    const ContractSpec& find(const Symbol& symbol) const {
+        for(const ContractSpec& spec : specs_){
+            if(spec.symbol.view() == symbol.view()){
+                return spec;
+            }
+        }
+        return fallback_;
+    }
+
+    // The first spec added, which a single book trades under, or the fallback.
+    const ContractSpec& primary() const { return specs_.empty() ? fallback_ : specs_.front(); }
+    bool empty() const { return specs_.empty(); }
+};
+
+inline void PrintReport(const ExecutionReport& report, std::ostream& out, const ContractSpec& contract = defaultContract){
+    char price[32];
+    const char* side = report.side == Side::Buy ? "Buy" : "Sell";
+    switch(report.type){
+    case ExecType::Ack:
+        out << "Order# " << report.orderId << " confirmed.\n";
+        break;
+    case ExecType::Fill:
+        out << side << " Order# " << report.orderId << (report.leaves == 0 ? " fully filled @ " : " partially filled @ ")
+            << contract.format(report.price, price) << " for " << report.quantity << " units.\n";
+        break;
+    case ExecType::Kill:{
+        const char* name = report.stopType == StopType::Stop ? "Stop"
+            : report.orderType == OrderType::FillOrKill ? "FillorKill" : "ImmediateOrCancel";
+        if(report.leaves == report.quantity){
+            out << name << " Order# " << report.orderId << " could not be filled so it was cancelled.\n";
+        }else{
+            out << name << " Order# " << report.orderId << " was killed with " << report.leaves << " units unfilled.\n";
+        }
+        break;
+    }
+    case ExecType::Cancel:
+        out << side << " Order# " << report.orderId << " cancelled with " << report.leaves << " units open.\n";
+        break;
+    case ExecType::Replace:
+        out << side << " Order# " << report.orderId << " replaced: " << report.quantity << " units @ " << contract.format(report.price, price)
+            << ", " << report.leaves << " open.\n";
+        break;
+    case ExecType::Trigger:
+        out << side << " stop Order# " << report.orderId << " triggered @ " << contract.format(report.price, price) << ".\n";
+        break;
+    case ExecType::SelfTrade:
+        out << side << " Order# " << report.orderId << " reduced by " << report.quantity << " units to prevent a self-trade, "
+            << report.leaves << " open.\n";
+        break;
+    case ExecType::MassCancel:
+        out << "Mass cancel# " << report.orderId << " cancelled " << report.quantity << " orders with " << report.leaves << " units open.\n";
+        break;
+    case ExecType::Reject:
+        switch(report.reason){
+        case RejectReason::MalformedMessage: out << "Not a valid FIX order\n"; break;
+        case RejectReason::BadBodyLength: out << "Invalid body length. (9)\n"; break;
+        case RejectReason::BadCheckSum: out << "Invalid checksum. (10)\n"; break;
+        case RejectReason::UnsupportedMsgType: out << "This orderbook only accepts new order, cancel, cancel/replace and mass cancel messages. (35)\n"; break;
+        case RejectReason::InvalidOrderType: out << "Invalid order type. (21)\n"; break;
+        case RejectReason::InvalidSide: out << "Invalid order side. (54)\n"; break;
+        case RejectReason::InvalidQuantity: out << "Invalid order quantity. (38)\n"; break;
+        case RejectReason::InvalidPrice: out << "Price is not an increment of a tick (" << contract.format(1, price) << "). (44)\n"; break;
+        case RejectReason::InvalidSymbol: out << "Invalid symbol. (55)\n"; break;
+        case RejectReason::DuplicateOrderId: out << "Order# " << report.orderId << " was rejected: an order with this order number already exists.\n"; break;
+        case RejectReason::UnknownOrderId: out << "Order# " << report.orderId << " was rejected: no open order with this order number.\n"; break;
+        case RejectReason::PriceOutOfRange: out << "Order# " << report.orderId << " was rejected: priced too far from the book.\n"; break;
+        case RejectReason::PoolExhausted: out << "Order# " << report.orderId << " was rejected: order pool exhausted.\n"; break;
+        case RejectReason::PriceOutsideBand: out << "Order# " << report.orderId << " was rejected: priced outside the price band.\n"; break;
+        case RejectReason::QuantityTooLarge: out << "Order# " << report.orderId << " was rejected: quantity above the maximum order size.\n"; break;
+        case RejectReason::RiskOrderSize: out << "Order# " << report.orderId << " was rejected: quantity above the account's order size limit.\n"; break;
+        case RejectReason::RiskOpenQuantity: out << "Order# " << report.orderId << " was rejected: the account's open quantity limit would be exceeded.\n"; break;
+        case RejectReason::RiskPriceDistance: out << "Order# " << report.orderId << " was rejected: priced too far through the best price.\n"; break;
+        case RejectReason::JournalFailed: out << "Order# " << report.orderId << " was rejected: the journal could not be written.\n"; break;
+        default: out << "Order# " << report.orderId << " was rejected.\n"; break;
+        }
+        break;
+    }
+}
+
+constexpr char fixSoh = '\x01';
+
+inline bool parseUint(std::string_view text, uint32& out){
+    if(text.empty() || text.size() > 10){
+        return false;
+    }
+    uint64 value = 0;
+    for(char c : text){
+        if(c < '0' || c > '9'){
+            return false;
+        }
+        value = value * 10 + static_cast<uint64>(c - '0');
+    }
+    if(value > std::numeric_limits<uint32>::max()){
+        return false;
+    }
+    out = static_cast<uint32>(value);
+    return true;
+}
+
+
+struct FixField{
+    uint32 tag;
+    std::string_view value;
+};
+
+// Single pass tag=value splitter over the caller's buffer. Fields are looked up by tag
+// number, BodyLength (9) and CheckSum (10) are verified on the way, and either SOH or '|'
+// is accepted as the delimiter, with '|' counted as SOH for the checksum.
+class FixMessage{
+private:
+    static constexpr uint32 maxFields = 64;
+    std::array<FixField, maxFields> fields_;
+    uint32 count_ = 0;
+
+public:
+    RejectReason parse(std::string_view msg){
+        count_ = 0;
+        while(!msg.empty() && (msg.back() == '\r' || msg.back() == '\n' || msg.back() == ' ')){
+            msg.remove_suffix(1);
+        }
+        if(msg.size() < 2 || msg[0] != '8' || msg[1] != '='){
+            return RejectReason::MalformedMessage;
+        }
+
+        size_t pos = 0;
+        size_t bodyStart = 0;
+        uint32 sum = 0;
+        char delim = 0;
+        while(pos < msg.size()){
+            size_t fieldStart = pos;
+            uint32 tag = 0;
+            uint32 fieldSum = '=';
+            while(pos < msg.size() && msg[pos] >= '0' && msg[pos] <= '9'){
+                tag = tag * 10 + static_cast<uint32>(msg[pos] - '0');
+                fieldSum += static_cast<unsigned char>(msg[pos]);
+                pos++;
+            }
+            if(pos == fieldStart || pos == msg.size() || msg[pos] != '='){
+                return RejectReason::MalformedMessage;
+            }
+            size_t valueStart = ++pos;
+            while(pos < msg.size() && msg[pos] != fixSoh && msg[pos] != '|'){
+                fieldSum += static_cast<unsigned char>(msg[pos]);
+                pos++;
+            }
+            std::string_view value = msg.substr(valueStart, pos - valueStart);
+
+            if(tag == 10){
+                uint32 checkSum = 0;
+                if(count_ < 3 || pos + 1 < msg.size() || !parseUint(value, checkSum)){
+                    return RejectReason::MalformedMessage;
+                }
+                uint32 bodyLength = 0;
+                parseUint(fields_[1].value, bodyLength);
+                if(bodyLength != fieldStart - bodyStart){
+                    return RejectReason::BadBodyLength;
+                }
+                if(checkSum != sum % 256){
+                    return RejectReason::BadCheckSum;
+                }
+                return RejectReason::None;
+            }
+
+            if(pos == msg.size() || count_ == maxFields){
+                return RejectReason::MalformedMessage;
+            }
+            if(delim == 0){
+                delim = msg[pos];
+            }else if(msg[pos] != delim){
+                return RejectReason::MalformedMessage;
+            }
+            sum += fieldSum + fixSoh;
+            pos++;
+
+            fields_[count_++] = FixField{tag, value};
+            if(count_ == 2){
+                if(tag != 9){
+                    return RejectReason::MalformedMessage;
+                }
+                bodyStart = pos;
+            }else if(count_ == 3 && tag != 35){
+                return RejectReason::MalformedMessage;
+            }
+        }
+        return RejectReason::MalformedMessage;
+    }
+
+    std::string_view get(uint32 tag) const {
+        for(uint32 i = 0; i < count_; i++){
+            if(fields_[i].tag == tag){
+                return fields_[i].value;
+            }
+        }
+        return {};
+    }
+};
+
+enum class CommandType{
+    New,
+    Cancel,
+    Replace,
+    MassCancel
+};
+
+// Which orders a mass cancel removes. Every condition that is set has to hold; resting
+// orders are matched on their price and pending stops on their stop price.
+struct CancelScope{
+    bool oneSide = false;
+    Side side = Side::Buy;
+    Tick low = std::numeric_limits<Tick>::min();
+    Tick high = std::numeric_limits<Tick>::max();
+    bool ownSession = false;
+};
+
+// Fixed-size, already validated instruction for a book. Every front end decodes into this,
+// so nothing downstream of the decoder has to deal with text.
+struct OrderCommand{
+    CommandType type = CommandType::New;
+    OrderType orderType = OrderType::GoodTillFill;
+    Side side = Side::Buy;
+    uint32 orderId = 0;
+    uint32 origOrderId = 0;
+    Tick price = 0;
+    uint32 quantity = 0;
+    StopType stopType = StopType::None;
+    Tick stopPrice = 0;
+    CancelScope scope;
+    Symbol symbol;
+    Symbol session;
+};
+
+inline bool CopyName(std::string_view text, Symbol& name){
+    if(text.size() > Symbol::maxLength){
+        return false;
+    }
+    std::copy(text.begin(), text.end(), name.name);
+    name.name[text.size()] = 0;
+    return true;
+}
+
+// Reads "ZN:tick=0.015625,low=100,high=130,max=5000,orders=100000". The tick has to divide a
+// point, and the band, size limit and book capacity may be left out.
+inline bool parseContract(std::string_view text, ContractSpec& spec){
+    spec = ContractSpec{};
+    size_t colon = text.find(':');
+    if(colon == 0 || !CopyName(text.substr(0, colon), spec.symbol)){
+        return false;
+    }
+    std::string_view tick, low, high, max, orders;
+    std::string_view fields = colon == std::string_view::npos ? std::string_view() : text.substr(colon + 1);
+    while(!fields.empty()){
+        size_t comma = fields.find(',');
+        std::string_view item = fields.substr(0, comma);
+        fields = comma == std::string_view::npos ? std::string_view() : fields.substr(comma + 1);
+        size_t eq = item.find('=');
+        std::string_view key = item.substr(0, eq);
+        std::string_view value = eq == std::string_view::npos ? std::string_view() : item.substr(eq + 1);
+        if(key == "tick"){
+            tick = value;
+        }else if(key == "low"){
+            low = value;
+        }else if(key == "high"){
+            high = value;
+        }else if(key == "max"){
+            max = value;
+        }else if(key == "orders"){
+            orders = value;
+        }else{
+            return false;
+        }
+    }
+    if(!tick.empty()){
+        constexpr int32 nanosPerPoint = 1000000000;
+        Tick nanos = 0;
+        if(!parseTicks(tick, nanos, nanosPerPoint) || nanos <= 0 || nanos > nanosPerPoint || nanosPerPoint % nanos != 0){
+            return false;
+        }
+        spec.ticksPerPoint = nanosPerPoint / nanos;
+    }
+    return (low.empty() || parseTicks(low, spec.lowBand, spec.ticksPerPoint))
+        && (high.empty() || parseTicks(high, spec.highBand, spec.ticksPerPoint))
+        && (max.empty() || (parseUint(max, spec.maxQuantity) && spec.maxQuantity > 0))
+        && (orders.empty() || (parseUint(orders, spec.orderCapacity) && spec.orderCapacity > 0))
+        && spec.lowBand <= spec.highBand;
+}
+
+// The instrument (55) and the session, which is the SenderCompID (49).
+inline RejectReason DecodeNames(const FixMessage& fix, OrderCommand& command){
+    if(!CopyName(fix.get(49), command.session)){
+        return RejectReason::MalformedMessage;
+    }
+    if(!CopyName(fix.get(55), command.symbol)){
+        return RejectReason::InvalidSymbol;
+    }
+    return RejectReason::None;
+}
+
+// Prices are in ticks of the instrument, so they are converted once 55 is known, with the
+// spec contractFor returns for it.
+template<typename ContractFor>
+inline RejectReason DecodeFixWith(std::string_view msg, OrderCommand& command, ContractFor&& contractFor){
+
+    FixMessage fix;
+    uint32 f21 = 0;
+    uint32 f54 = 0;
+
+    RejectReason status = fix.parse(msg);
+    parseUint(fix.get(11), command.orderId);
+    if(status != RejectReason::None){
+        return status;
+    }
+
+    std::string_view f35 = fix.get(35);
+    if(f35 == "F"){
+        if(!parseUint(fix.get(41), command.orderId) && !parseUint(fix.get(11), command.orderId)){
+            return RejectReason::MalformedMessage;
+        }
+        command.type = CommandType::Cancel;
+        return DecodeNames(fix, command);
+    }
+
+    if(f35 == "G"){
+        if(!parseUint(fix.get(41), command.origOrderId) || !parseUint(fix.get(11), command.orderId)){
+            return RejectReason::MalformedMessage;
+        }
+        if(!parseUint(fix.get(38), command.quantity) || command.quantity == 0){
+            return RejectReason::InvalidQuantity;
+        }
+        command.type = CommandType::Replace;
+        RejectReason names = DecodeNames(fix, command);
+        if(names != RejectReason::None){
+            return names;
+        }
+        if(!parseTicks(fix.get(44), command.price, contractFor(command.symbol).ticksPerPoint)){
+            return RejectReason::InvalidPrice;
+        }
+        return RejectReason::None;
+    }
+
+    // Order mass cancel: 530=1 or 7 cancels the whole book and 530=6 only the orders of the
+    // sending session. 54 limits it to one side and 6000/6001 to a price range.
+    if(f35 == "q"){
+        uint32 f530 = 0;
+        if(!parseUint(fix.get(11), command.orderId) || !parseUint(fix.get(530), f530) || (f530 != 1 && f530 != 6 && f530 != 7)){
+            return RejectReason::MalformedMessage;
+        }
+        CancelScope& scope = command.scope;
+        scope.ownSession = f530 == 6;
+        if(parseUint(fix.get(54), f54)){
+            if(f54 != 1 && f54 != 2){
+                return RejectReason::InvalidSide;
+            }
+            scope.oneSide = true;
+            scope.side = f54 == 1 ? Side::Buy : Side::Sell;
+        }
+        command.type = CommandType::MassCancel;
+        RejectReason names = DecodeNames(fix, command);
+        if(names != RejectReason::None){
+            return names;
+        }
+        int32 perPoint = contractFor(command.symbol).ticksPerPoint;
+        if((!fix.get(6000).empty() && !parseTicks(fix.get(6000), scope.low, perPoint)) || (!fix.get(6001).empty() && !parseTicks(fix.get(6001), scope.high, perPoint))){
+            return RejectReason::InvalidPrice;
+        }
+        return RejectReason::None;
+    }
+
+    if(f35 != "D"){
+        return RejectReason::UnsupportedMsgType;
+    }
+
+    if(!parseUint(fix.get(11), command.orderId)){
+        return RejectReason::MalformedMessage;
+    }
+
+    parseUint(fix.get(21), f21);
+    if(f21 == 1){
+        command.orderType = OrderType::FillOrKill;
+    } else if(f21 == 2){
+        command.orderType = OrderType::GoodTillFill;
+    } else if(f21 == 3){
+        command.orderType = OrderType::ImmediateOrCancel;
+    }else{
+        return RejectReason::InvalidOrderType;
+    }
+
+    parseUint(fix.get(54), f54);
+    if(f54 == 1){
+        command.side = Side::Buy;
+    }else if(f54 == 2){
+        command.side = Side::Sell;
+    }else{
+        return RejectReason::InvalidSide;
+    }
+
+    if(!parseUint(fix.get(38), command.quantity) || command.quantity == 0){
+        return RejectReason::InvalidQuantity;
+    }
+
+    command.type = CommandType::New;
+    RejectReason names = DecodeNames(fix, command);
+    if(names != RejectReason::None){
+        return names;
+    }
+    int32 perPoint = contractFor(command.symbol).ticksPerPoint;
+
+    std::string_view f40 = fix.get(40);
+    if(f40 == "3" || f40 == "4"){
+        command.stopType = f40 == "3" ? StopType::Stop : StopType::StopLimit;
+        if(!parseTicks(fix.get(99), command.stopPrice, perPoint)){
+            return RejectReason::InvalidPrice;
+        }
+    }
+
+    if(command.stopType == StopType::Stop){
+        command.price = command.stopPrice;
+    }else if(!parseTicks(fix.get(44), command.price, perPoint)){
+        return RejectReason::InvalidPrice;
+    }
+    return RejectReason::None;
+}
+
+// Every message priced in the ticks of one contract, whatever its 55 says.
+inline RejectReason DecodeFix(std::string_view msg, OrderCommand& command, const ContractSpec& contract = defaultContract){
+    return DecodeFixWith(msg, command, [&](const Symbol&) -> const ContractSpec& { return contract; });
+}
+
+inline RejectReason DecodeFix(std::string_view msg, OrderCommand& command, const ContractTable& contracts){
+    return DecodeFixWith(msg, command, [&](const Symbol& symbol) -> const ContractSpec& { return contracts.find(symbol); });
+}
+
+class LevelBitmap{
+private:
+    static constexpr uint32 wordBits = 64;
+    uint64 summary_ = 0;
+    std::array<uint64, wordBits> words_{};
+
+public:
+    static constexpr uint32 capacity = wordBits * wordBits;
+
+    void set(uint32 idx){
+        words_[idx / wordBits] |= 1ull << (idx % wordBits);
+        summary_ |= 1ull << (idx / wordBits);
+    }
+
+    void reset(uint32 idx){
+        uint32 word = idx / wordBits;
+        words_[word] &= ~(1ull << (idx % wordBits));
+        if(words_[word] == 0){
+            summary_ &= ~(1ull << word);
+        }
+    }
+
+    void clear(){
+        summary_ = 0;
+        words_.fill(0);
+    }
+
+    bool empty() const { return summary_ == 0; }
+
+    uint32 count() const {
+        uint32 total = 0;
+        for(uint64 word : words_){
+            total += __builtin_popcountll(word);
+        }
+        return total;
+    }
+
+    uint32 lowest() const {
+        uint32 word = __builtin_ctzll(summary_);
+        return word * wordBits + __builtin_ctzll(words_[word]);
+    }
+
+    uint32 highest() const {
+        uint32 word = wordBits - 1 - __builtin_clzll(summary_);
+        return word * wordBits + wordBits - 1 - __builtin_clzll(words_[word]);
+    }
+
+    // First set bit at or above idx, or capacity if there is none.
+    uint32 from(uint32 idx) const {
+        return idx == 0 ? (empty() ? capacity : lowest()) : above(idx - 1);
+    }
+
+    // Next set bit strictly below/above idx, or capacity if there is none.
+    uint32 below(uint32 idx) const {
+        uint32 word = idx / wordBits;
+        uint64 bits = words_[word] & ((1ull << (idx % wordBits)) - 1);
+        if(bits == 0){
+            uint64 rest = summary_ & ((1ull << word) - 1);
+            if(rest == 0){
+                return capacity;
+            }
+            word = wordBits - 1 - __builtin_clzll(rest);
+            bits = words_[word];
+        }
+        return word * wordBits + wordBits - 1 - __builtin_clzll(bits);
+    }
+
+    uint32 above(uint32 idx) const {
+        if(idx + 1 >= capacity){
+            return capacity;
+        }
+        idx++;
+        uint32 word = idx / wordBits;
+        uint64 bits = words_[word] & (~0ull << (idx % wordBits));
+        if(bits == 0){
+            uint64 rest = word + 1 < wordBits ? summary_ & (~0ull << (word + 1)) : 0;
+            if(rest == 0){
+                return capacity;
+            }
+            word = __builtin_ctzll(rest);
+            bits = words_[word];
+        }
+        return word * wordBits + __builtin_ctzll(bits);
+    }
+};
+
+// Log-linear latency histogram in nanoseconds: 16 sub-buckets per power of two, so every
+// recorded value is kept to within about 6% without storing the samples.
+class LatencyHistogram{
+private:
+    static constexpr uint32 subBits = 4;
+    static constexpr uint32 subCount = 1 << subBits;
+    std::array<uint64, 64 * subCount> counts_{};
+    uint64 total_ = 0;
+    uint64 sum_ = 0;
+    uint64 max_ = 0;
+
+    static uint32 bucketOf(uint64 value){
+        if(value < subCount){
+            return static_cast<uint32>(value);
+        }
+        uint32 exp = 63 - __builtin_clzll(value);
+        return (exp - subBits + 1) * subCount + static_cast<uint32>((value >> (exp - subBits)) & (subCount - 1));
+    }
+
+    static uint64 bucketTop(uint32 bucket){
+        if(bucket < subCount){
+            return bucket;
+        }
+        uint32 exp = bucket / subCount + subBits - 1;
+        uint64 base = static_cast<uint64>(subCount + bucket % subCount) << (exp - subBits);
+        return base + (1ull << (exp - subBits)) - 1;
+    }
+
+public:
+    void record(uint64 nanos){
+        counts_[bucketOf(nanos)]++;
+        total_++;
+        sum_ += nanos;
+        max_ = std::max(max_, nanos);
+    }
+
+    void merge(const LatencyHistogram& other){
+        for(size_t i = 0; i < counts_.size(); i++){
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    void reset(){
+        counts_.fill(0);
+        total_ = 0;
+        sum_ = 0;
+        max_ = 0;
+    }
+
+    uint64 count() const { return total_; }
+    uint64 sum() const { return sum_; }
+    uint64 max() const { return max_; }
+    double mean() const { return total_ ? static_cast<double>(sum_) / total_ : 0.0; }
+
+    uint64 percentile(double pct) const {
+        if(total_ == 0){
+            return 0;
+        }
+        uint64 rank = static_cast<uint64>(std::ceil(pct / 100.0 * total_));
+        uint64 seen = 0;
+        for(uint32 i = 0; i < counts_.size(); i++){
+            seen += counts_[i];
+            if(seen >= rank && counts_[i] != 0){
+                return std::min(bucketTop(i), max_);
+            }
+        }
+        return max_;
+    }
+};
+
+// Raw timestamp for latency spans: the TSC where there is one, steady_clock elsewhere.
+// Spans are recorded in these units and only scaled to nanoseconds when they are read.
+inline uint64 cycleCount(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline double nanosPerCycle(){
+    static const double ratio = [](){
+#if defined(__x86_64__) || defined(__i386__)
+        auto start = std::chrono::steady_clock::now();
+        uint64 cycles = cycleCount();
+        while(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(5)){
+        }
+        uint64 elapsed = cycleCount() - cycles;
+        double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        return elapsed > 0 ? nanos / elapsed : 1.0;
+#else
+        return 1.0;
+#endif
+    }();
+    return ratio;
+}
+
+enum class Stage{
+    Parse,
+    Add,
+    Match,
+    Depth,
+    Cancel,
+    Replace
+};
+
+constexpr size_t stageCount = 6;
+
+inline const char* StageName(Stage stage){
+    switch(stage){
+    case Stage::Parse: return "parse";
+    case Stage::Add: return "add";
+    case Stage::Match: return "match";
+    case Stage::Depth: return "depth";
+    case Stage::Cancel: return "cancel";
+    case Stage::Replace: return "replace";
+    }
+    return "?";
+}
+
+// Always-on counters and per-stage latency for one book. A book is only driven by one
+// thread, so recording is plain stores into its own histograms; other threads read a
+// copy once that thread is idle and merge copies across books. Reading the clock costs
+// about as much as a cancel, so only one call in every sampleEvery per stage is timed.
+class EngineStats{
+public:
+    static constexpr uint32 defaultSampleEvery = 16;
+
+private:
+    std::array<LatencyHistogram, stageCount> stages_;
+    std::array<uint32, stageCount> calls_{};
+    uint32 sampleMask_ = defaultSampleEvery - 1;
+    uint64 orders_ = 0;
+    uint64 fills_ = 0;
+    uint64 kills_ = 0;
+    uint64 cancels_ = 0;
+    uint64 replaces_ = 0;
+    uint64 triggers_ = 0;
+    uint64 massCancels_ = 0;
+    uint64 selfTrades_ = 0;
+    uint64 rejects_ = 0;
+    uint64 restingOrders_ = 0;
+    uint64 poolCapacity_ = 0;
+    uint64 bidLevels_ = 0;
+    uint64 askLevels_ = 0;
+    uint64 droppedReports_ = 0;
+    uint64 droppedDepth_ = 0;
+
+    uint64 nanos(uint64 cycles) const { return static_cast<uint64>(cycles * nanosPerCycle()); }
+
+public:
+    // Times the enclosing scope into one stage.
+    class Span{
+    private:
+        LatencyHistogram* histogram_;
+        uint64 start_;
+
+    public:
+        explicit Span(LatencyHistogram* histogram):
+            histogram_ (histogram),
+            start_ (histogram ? cycleCount() : 0)
+            {}
+
+            ~Span(){
+                if(histogram_ != nullptr){
+                    histogram_ -> record(cycleCount() - start_);
+                }
+            }
+
+            Span(const Span&) = delete;
+            Span& operator=(const Span&) = delete;
+    };
+
+    Span time(Stage stage){
+        size_t i = static_cast<size_t>(stage);
+        return Span((calls_[i]++ & sampleMask_) == 0 ? &stages_[i] : nullptr);
+    }
+
+    // Rounded up to a power of two; 1 times every call.
+    void setSampleEvery(uint32 sampleEvery){
+        uint32 size = 1;
+        while(size < sampleEvery){
+            size <<= 1;
+        }
+        sampleMask_ = size - 1;
+    }
+
+    void count(ExecType type){
+        switch(type){
+        case ExecType::Ack: orders_++; break;
+        case ExecType::Fill: fills_++; break;
+        case ExecType::Kill: kills_++; break;
+        case ExecType::Cancel: cancels_++; break;
+        case ExecType::Replace: replaces_++; break;
+        case ExecType::Trigger: triggers_++; break;
+        case ExecType::MassCancel: massCancels_++; break;
+        case ExecType::SelfTrade: selfTrades_++; break;
+        case ExecType::Reject: rejects_++; break;
+        }
+    }
+
+    void setGauges(uint64 restingOrders, uint64 poolCapacity, uint64 bidLevels, uint64 askLevels){
+        restingOrders_ = restingOrders;
+        poolCapacity_ = poolCapacity;
+        bidLevels_ = bidLevels;
+        askLevels_ = askLevels;
+    }
+
+    // Events the report and depth rings threw away because they were full and had no sink.
+    void setDropped(uint64 reports, uint64 depth){
+        droppedReports_ = reports;
+        droppedDepth_ = depth;
+    }
+
+    void merge(const EngineStats& other){
+        for(size_t i = 0; i < stageCount; i++){
+            stages_[i].merge(other.stages_[i]);
+        }
+        orders_ += other.orders_;
+        fills_ += other.fills_;
+        kills_ += other.kills_;
+        cancels_ += other.cancels_;
+        replaces_ += other.replaces_;
+        triggers_ += other.triggers_;
+        massCancels_ += other.massCancels_;
+        selfTrades_ += other.selfTrades_;
+        rejects_ += other.rejects_;
+        restingOrders_ += other.restingOrders_;
+        poolCapacity_ += other.poolCapacity_;
+        bidLevels_ += other.bidLevels_;
+        askLevels_ += other.askLevels_;
+        droppedReports_ += other.droppedReports_;
+        droppedDepth_ += other.droppedDepth_;
+    }
+
+    void reset(){
+        for(LatencyHistogram& stage : stages_){
+            stage.reset();
+        }
+        orders_ = fills_ = kills_ = cancels_ = replaces_ = triggers_ = massCancels_ = selfTrades_ = rejects_ = 0;
+    }
+
+    void Print(std::ostream& out) const {
+        out << "Orders: " << orders_ << "  Fills: " << fills_ << "  Kills: " << kills_ << "  Cancels: " << cancels_
+            << "  Replaces: " << replaces_ << "  Triggers: " << triggers_ << "  Mass cancels: " << massCancels_ << "  Self-trades: " << selfTrades_ << "  Rejects: " << rejects_ << "\n";
+        out << "Resting orders: " << restingOrders_ << " / " << poolCapacity_ << "  Bid levels: " << bidLevels_
+            << "  Ask levels: " << askLevels_ << "  Dropped reports: " << droppedReports_ << "  Dropped depth: " << droppedDepth_ << "\n";
+        out << std::left << std::setw(10) << "stage" << std::right << std::setw(12) << "count" << std::setw(10) << "mean"
+            << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(12) << "max (ns)" << "\n";
+        for(size_t i = 0; i < stageCount; i++){
+            const LatencyHistogram& stage = stages_[i];
+            out << std::left << std::setw(10) << StageName(static_cast<Stage>(i)) << std::right << std::setw(12) << stage.count()
+                << std::setw(10) << nanos(static_cast<uint64>(stage.mean())) << std::setw(10) << nanos(stage.percentile(50))
+                << std::setw(10) << nanos(stage.percentile(99)) << std::setw(10) << nanos(stage.percentile(99.9))
+                << std::setw(12) << nanos(stage.max()) << "\n";
+        }
+        out.flush();
+    }
+
+    // One JSON object on one line, for appending to a stats log.
+    void WriteJson(std::ostream& out, uint64 messages) const {
+        out << "{\"messages\":" << messages << ",\"orders\":" << orders_ << ",\"fills\":" << fills_ << ",\"kills\":" << kills_
+            << ",\"cancels\":" << cancels_ << ",\"replaces\":" << replaces_ << ",\"triggers\":" << triggers_ << ",\"massCancels\":" << massCancels_ << ",\"selfTrades\":" << selfTrades_ << ",\"rejects\":" << rejects_
+            << ",\"restingOrders\":" << restingOrders_ << ",\"poolCapacity\":" << poolCapacity_
+            << ",\"bidLevels\":" << bidLevels_ << ",\"askLevels\":" << askLevels_
+            << ",\"droppedReports\":" << droppedReports_ << ",\"droppedDepth\":" << droppedDepth_ << ",\"stages\":{";
+        for(size_t i = 0; i < stageCount; i++){
+            const LatencyHistogram& stage = stages_[i];
+            out << (i ? "," : "") << '"' << StageName(static_cast<Stage>(i)) << "\":{\"count\":" << stage.count()
+                << ",\"meanNs\":" << nanos(static_cast<uint64>(stage.mean())) << ",\"p50Ns\":" << nanos(stage.percentile(50))
+                << ",\"p99Ns\":" << nanos(stage.percentile(99)) << ",\"p999Ns\":" << nanos(stage.percentile(99.9))
+                << ",\"maxNs\":" << nanos(stage.max()) << '}';
+        }
+        out << "}}\n";
+    }
+};
+
+inline void putLE(unsigned char* out, uint64 value, size_t bytes){
+    for(size_t i = 0; i < bytes; i++){
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+inline uint64 getLE(const unsigned char* in, size_t bytes){
+    uint64 value = 0;
+    for(size_t i = 0; i < bytes; i++){
+        value |= static_cast<uint64>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+inline uint64 fnv1a(const unsigned char* data, size_t size){
+    uint64 hash = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < size; i++){
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Read-only mapping of a whole file, unmapped on destruction.
+class MappedFile{
+private:
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+
+public:
+    explicit MappedFile(const char* path){
+        int fd = ::open(path, O_RDONLY);
+        if(fd < 0){
+            return;
+        }
+        struct stat st;
+        if(::fstat(fd, &st) == 0 && st.st_size > 0){
+            void* mapped = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapped != MAP_FAILED){
+                data_ = static_cast<const unsigned char*>(mapped);
+                size_ = static_cast<size_t>(st.st_size);
+            }
+        }
+        ::close(fd);
+    }
+
+        ~MappedFile(){
+            if(data_ != nullptr){
+                ::munmap(const_cast<unsigned char*>(data_), size_);
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const unsigned char* data() const { return data_; }
+        size_t size() const { return size_; }
+};
+
+// Binary order entry, little-endian with SBE-style framing: an 8-byte header
+// blockLength u16 | templateId u16 | schemaId u16 | version u16
+// followed by one fixed block per template (offsets within the block):
+// 1 new         orderId u32 | price i32 ticks | quantity u32 | side u8 (54) | orderType u8 (21) | pad u16 | symbol | session
+// 2 cancel      orderId u32 (11) | origOrderId u32 (41, 0 if absent) | symbol | session
+// 3 replace     orderId u32 (11) | origOrderId u32 (41) | price i32 ticks | quantity u32 | symbol | session
+// 4 new stop    orderId u32 | price i32 ticks | quantity u32 | side u8 | orderType u8 | stopType u8 (40) | pad u8 | stopPrice i32 (99) | symbol | session
+// 5 mass cancel requestId u32 (11) | low i32 ticks | high i32 ticks | side u8 (54, 0 for both) | type u8 (530) | pad u16 | symbol | session
+// Enumerations keep their FIX values. symbol (55) and session (49) are char[16], NUL padded.
+constexpr size_t binaryHeaderSize = 8;
+constexpr uint16_t binarySchemaId = 1;
+constexpr uint16_t binaryVersion = 1;
+constexpr uint16_t binaryNewOrder = 1;
+constexpr uint16_t binaryCancel = 2;
+constexpr uint16_t binaryReplace = 3;
+constexpr uint16_t binaryNewStopOrder = 4;
+constexpr uint16_t binaryMassCancel = 5;
+constexpr uint16_t binaryNewOrderBlock = 48;
+constexpr uint16_t binaryCancelBlock = 40;
+constexpr uint16_t binaryReplaceBlock = 48;
+constexpr uint16_t binaryNewStopOrderBlock = 52;
+constexpr uint16_t binaryMassCancelBlock = 48;
+constexpr size_t binaryMaxMessageSize = binaryHeaderSize + 52;
+
+inline RejectReason DecodeBinaryNames(const unsigned char* in, OrderCommand& command){
+    constexpr size_t size = sizeof(command.symbol.name);
+    if(std::memchr(in, 0, size) == nullptr){
+        return RejectReason::InvalidSymbol;
+    }
+    if(std::memchr(in + size, 0, size) == nullptr){
+        return RejectReason::MalformedMessage;
+    }
+    std::memcpy(command.symbol.name, in, size);
+    std::memcpy(command.session.name, in + size, size);
+    return RejectReason::None;
+}
+
+inline RejectReason DecodeBinary(const unsigned char* data, size_t size, OrderCommand& command){
+    if(size < binaryHeaderSize){
+        return RejectReason::BadBodyLength;
+    }
+    uint16_t blockLength = static_cast<uint16_t>(getLE(data, 2));
+    uint16_t templateId = static_cast<uint16_t>(getLE(data + 2, 2));
+    if(size != binaryHeaderSize + blockLength){
+        return RejectReason::BadBodyLength;
+    }
+    if(getLE(data + 4, 2) != binarySchemaId || getLE(data + 6, 2) != binaryVersion){
+        return RejectReason::UnsupportedMsgType;
+    }
+    // Every template starts with the order id, so a block too short for it is rejected
+    // before it is read; the id is kept for the reject report of any other bad length.
+    if(blockLength < 4){
+        return RejectReason::BadBodyLength;
+    }
+    const unsigned char* block = data + binaryHeaderSize;
+    command.orderId = static_cast<uint32>(getLE(block, 4));
+
+    switch(templateId){
+    case binaryNewOrder:
+    case binaryNewStopOrder:
+        if(blockLength != (templateId == binaryNewOrder ? binaryNewOrderBlock : binaryNewStopOrderBlock)){
+            return RejectReason::BadBodyLength;
+        }
+        switch(block[13]){
+        case 1: command.orderType = OrderType::FillOrKill; break;
+        case 2: command.orderType = OrderType::GoodTillFill; break;
+        case 3: command.orderType = OrderType::ImmediateOrCancel; break;
+        default: return RejectReason::InvalidOrderType;
+        }
+        if(block[12] != 1 && block[12] != 2){
+            return RejectReason::InvalidSide;
+        }
+        command.side = block[12] == 1 ? Side::Buy : Side::Sell;
+        command.quantity = static_cast<uint32>(getLE(block + 8, 4));
+        if(command.quantity == 0){
+            return RejectReason::InvalidQuantity;
+        }
+        command.price = static_cast<Tick>(static_cast<uint32>(getLE(block + 4, 4)));
+        command.type = CommandType::New;
+        if(templateId == binaryNewOrder){
+            return DecodeBinaryNames(block + 16, command);
+        }
+        if(block[14] != 3 && block[14] != 4){
+            return RejectReason::InvalidOrderType;
+        }
+        command.stopType = block[14] == 3 ? StopType::Stop : StopType::StopLimit;
+        command.stopPrice = static_cast<Tick>(static_cast<uint32>(getLE(block + 16, 4)));
+        return DecodeBinaryNames(block + 20, command);
+
+    case binaryCancel:
+        if(blockLength != binaryCancelBlock){
+            return RejectReason::BadBodyLength;
+        }
+        if(uint32 origOrderId = static_cast<uint32>(getLE(block + 4, 4))){
+            command.orderId = origOrderId;
+        }
+        command.type = CommandType::Cancel;
+        return DecodeBinaryNames(block + 8, command);
+
+    case binaryReplace:
+        if(blockLength != binaryReplaceBlock){
+            return RejectReason::BadBodyLength;
+        }
+        command.origOrderId = static_cast<uint32>(getLE(block + 4, 4));
+        command.price = static_cast<Tick>(static_cast<uint32>(getLE(block + 8, 4)));
+        command.quantity = static_cast<uint32>(getLE(block + 12, 4));
+        if(command.quantity == 0){
+            return RejectReason::InvalidQuantity;
+        }
+        command.type = CommandType::Replace;
+        return DecodeBinaryNames(block + 16, command);
+
+    case binaryMassCancel:
+        if(blockLength != binaryMassCancelBlock){
+            return RejectReason::BadBodyLength;
+        }
+        if(block[12] > 2){
+            return RejectReason::InvalidSide;
+        }
+        if(block[13] != 1 && block[13] != 6 && block[13] != 7){
+            return RejectReason::MalformedMessage;
+        }
+        command.scope.low = static_cast<Tick>(static_cast<uint32>(getLE(block + 4, 4)));
+        command.scope.high = static_cast<Tick>(static_cast<uint32>(getLE(block + 8, 4)));
+        command.scope.oneSide = block[12] != 0;
+        command.scope.side = block[12] == 2 ? Side::Sell : Side::Buy;
+        command.scope.ownSession = block[13] == 6;
+        command.type = CommandType::MassCancel;
+        return DecodeBinaryNames(block + 16, command);
+
+    default:
+        return RejectReason::UnsupportedMsgType;
+    }
+}
+
+// Writes command in the binary layout and returns its size, at most binaryMaxMessageSize.
+inline size_t EncodeBinary(const OrderCommand& command, unsigned char* out){
+    uint16_t templateId = binaryNewOrder;
+    uint16_t blockLength = binaryNewOrderBlock;
+    size_t namesOffset = 16;
+    switch(command.type){
+    case CommandType::New:
+        if(command.stopType != StopType::None){
+            templateId = binaryNewStopOrder;
+            blockLength = binaryNewStopOrderBlock;
+            namesOffset = 20;
+        }
+        break;
+    case CommandType::Cancel:
+        templateId = binaryCancel;
+        blockLength = binaryCancelBlock;
+        namesOffset = 8;
+        break;
+    case CommandType::Replace:
+        templateId = binaryReplace;
+        blockLength = binaryReplaceBlock;
+        break;
+    case CommandType::MassCancel:
+        templateId = binaryMassCancel;
+        blockLength = binaryMassCancelBlock;
+        break;
+    }
+    std::memset(out, 0, binaryHeaderSize + blockLength);
+    putLE(out, blockLength, 2);
+    putLE(out + 2, templateId, 2);
+    putLE(out + 4, binarySchemaId, 2);
+    putLE(out + 6, binaryVersion, 2);
+    unsigned char* block = out + binaryHeaderSize;
+    putLE(block, command.orderId, 4);
+    switch(command.type){
+    case CommandType::New:
+        putLE(block + 4, static_cast<uint32>(command.price), 4);
+        putLE(block + 8, command.quantity, 4);
+        block[12] = command.side == Side::Buy ? 1 : 2;
+        block[13] = command.orderType == OrderType::FillOrKill ? 1 : command.orderType == OrderType::GoodTillFill ? 2 : 3;
+        if(command.stopType != StopType::None){
+            block[14] = command.stopType == StopType::Stop ? 3 : 4;
+            putLE(block + 16, static_cast<uint32>(command.stopPrice), 4);
+        }
+        break;
+    case CommandType::Cancel:
+        break;
+    case CommandType::Replace:
+        putLE(block + 4, command.origOrderId, 4);
+        putLE(block + 8, static_cast<uint32>(command.price), 4);
+        putLE(block + 12, command.quantity, 4);
+        break;
+    case CommandType::MassCancel:
+        putLE(block + 4, static_cast<uint32>(command.scope.low), 4);
+        putLE(block + 8, static_cast<uint32>(command.scope.high), 4);
+        block[12] = !command.scope.oneSide ? 0 : command.scope.side == Side::Buy ? 1 : 2;
+        block[13] = command.scope.ownSession ? 6 : 7;
+        break;
+    }
+    std::memcpy(block + namesOffset, command.symbol.name, sizeof(command.symbol.name));
+    std::memcpy(block + namesOffset + sizeof(command.symbol.name), command.session.name, sizeof(command.session.name));
+    return binaryHeaderSize + blockLength;
+}
+
+// Calls onFrame for every binary message in a file, mapped rather than read. Stops at a
+// truncated frame.
+template<typename FrameHandler>
+bool ForEachFrame(const char* path, FrameHandler&& onFrame){
+    MappedFile file(path);
+    if(file.data() == nullptr){
+        return false;
+    }
+    size_t offset = 0;
+    while(offset + binaryHeaderSize <= file.size()){
+        size_t size = binaryHeaderSize + static_cast<size_t>(getLE(file.data() + offset, 2));
+        if(offset + size > file.size()){
+            break;
+        }
+        onFrame(file.data() + offset, size);
+        offset += size;
+    }
+    return true;
+}
+
+// Binary logs are told apart from FIX logs, which may start with any text, by the schema id
+// in the header of their first frame.
+inline bool IsBinaryLog(const char* path){
+    std::ifstream file(path, std::ios::binary);
+    unsigned char head[binaryHeaderSize] = {};
+    return file.read(reinterpret_cast<char*>(head), binaryHeaderSize) && getLE(head + 4, 2) == binarySchemaId;
+}
+
+// Append-only write-ahead log of the commands a book has executed, as fixed 48-byte
+// little-endian records:
+// sequence u64 | type u8 | orderType u8 | side u8 | stopType u8 | orderId u32 | origOrderId u32 | price i32 | quantity u32
+// | session char[16] | checksum u32
+// New orders have no origOrderId and carry their stop price in its place. Mass cancels keep
+// 530 in orderType, 0 (both) or 54 in side, and their price range in price and origOrderId.
+// Records are buffered and a flusher thread writes them with one write + fdatasync per
+// group, as soon as maxBatch records are pending or at most maxDelay after the first one,
+// so an idle book still commits its tail. Reports are not held back for the commit: an ack
+// can run ahead of the journal by the group in flight, which a crash loses. A torn record
+// at the tail is cut off on open. Once a write or sync fails the journal stops taking
+// records, append returns 0 and the book rejects everything after it.
+class Journal{
+public:
+    static constexpr size_t recordSize = 48;
+
+private:
+    int fd_ = -1;
+    std::vector<unsigned char> buffer_;
+    std::vector<unsigned char> flushing_;
+    uint32 maxBatch_;
+    std::chrono::steady_clock::duration maxDelay_;
+    uint64 sequence_ = 0;
+    uint64 durable_ = 0;
+    uint64 commits_ = 0;
+    uint32 waiters_ = 0;
+    int error_ = 0;
+    bool stopping_ = false;
+    std::atomic<bool> failed_{false};
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable committed_;
+    std::condition_variable space_;
+    std::thread flusher_;
+
+    static uint32 checksum(const unsigned char* record){
+        return static_cast<uint32>(fnv1a(record, recordSize - 4));
+    }
+
+    static bool decode(const unsigned char* record, uint64& sequence, OrderCommand& command){
+        if(getLE(record + 44, 4) != checksum(record)){
+            return false;
+        }
+        sequence = getLE(record, 8);
+        command.type = static_cast<CommandType>(record[8]);
+        command.orderType = static_cast<OrderType>(record[9]);
+        command.side = record[10] == 0 ? Side::Buy : Side::Sell;
+        command.stopType = static_cast<StopType>(record[11]);
+        command.orderId = static_cast<uint32>(getLE(record + 12, 4));
+        command.origOrderId = static_cast<uint32>(getLE(record + 16, 4));
+        command.price = static_cast<Tick>(static_cast<uint32>(getLE(record + 20, 4)));
+        if(command.type == CommandType::New){
+            command.stopPrice = static_cast<Tick>(command.origOrderId);
+            command.origOrderId = 0;
+        }else if(command.type == CommandType::MassCancel){
+            command.scope.ownSession = record[9] == 6;
+            command.scope.oneSide = record[10] != 0;
+            command.scope.side = record[10] == 2 ? Side::Sell : Side::Buy;
+            command.scope.low = command.price;
+            command.scope.high = static_cast<Tick>(command.origOrderId);
+            command.orderType = OrderType::GoodTillFill;
+            command.side = Side::Buy;
+            command.price = 0;
+            command.origOrderId = 0;
+        }
+        command.quantity = static_cast<uint32>(getLE(record + 24, 4));
+        std::memcpy(command.session.name, record + 28, sizeof(command.session.name));
+        command.session.name[Symbol::maxLength] = 0;
+        return true;
+    }
+
+public:
+    explicit Journal(uint32 maxBatch = 256, uint32 maxDelayMicros = 1000):
+        maxBatch_ (maxBatch),
+        maxDelay_ (std::chrono::microseconds(maxDelayMicros))
+        {}
+
+        ~Journal(){
+            close();
+        }
+
+        Journal(const Journal&) = delete;
+        Journal& operator=(const Journal&) = delete;
+
+        // Calls onCommand(sequence, command) for every intact record after afterSequence and
+        // returns the last intact sequence. Sequences are consecutive, so the tail is found
+        // by offset instead of by scanning.
+        template<typename CommandHandler>
+        static uint64 Replay(const char* path, uint64 afterSequence, CommandHandler&& onCommand, size_t* validBytes = nullptr){
+            MappedFile file(path);
+            size_t records = file.size() / recordSize;
+            uint64 sequence = 0;
+            OrderCommand command;
+            uint64 last = 0;
+            size_t next = 0;
+            if(records > 0 && decode(file.data(), sequence, command)){
+                uint64 first = sequence;
+                last = first - 1;
+                if(afterSequence >= first){
+                    next = static_cast<size_t>(std::min<uint64>(afterSequence - first + 1, records));
+                    last = first + next - 1;
+                }
+            }
+            for(; next < records; next++){
+                if(!decode(file.data() + next * recordSize, sequence, command) || sequence != last + 1){
+                    break;
+                }
+                last = sequence;
+                onCommand(sequence, command);
+            }
+            if(validBytes != nullptr){
+                *validBytes = next * recordSize;
+            }
+            return last;
+        }
+
+        bool open(const char* path){
+            size_t validBytes = 0;
+            sequence_ = Replay(path, std::numeric_limits<uint64>::max(), [](uint64, const OrderCommand&){}, &validBytes);
+            fd_ = ::open(path, O_WRONLY | O_CREAT, 0644);
+            if(fd_ < 0){
+                return false;
+            }
+            if(::ftruncate(fd_, static_cast<off_t>(validBytes)) != 0 || ::lseek(fd_, 0, SEEK_END) < 0){
+                ::close(fd_);
+                fd_ = -1;
+                return false;
+            }
+            durable_ = sequence_;
+            buffer_.reserve(recordSize * maxBatch_);
+            flushing_.reserve(recordSize * maxBatch_);
+            stopping_ = false;
+            flusher_ = std::thread([this](){ Flush(); });
+            return true;
+        }
+
+        void close(){
+            if(fd_ >= 0){
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stopping_ = true;
+                }
+                wake_.notify_one();
+                flusher_.join();
+                ::close(fd_);
+                fd_ = -1;
+            }
+        }
+
+        bool isOpen() const { return fd_ >= 0; }
+        bool failed() const { return failed_.load(std::memory_order_acquire); }
+        int getError() const { return error_; }
+        uint64 getSequence() const { return sequence_; }
+
+        uint64 getCommits(){
+            std::lock_guard<std::mutex> lock(mutex_);
+            return commits_;
+        }
+
+        // Returns the record's sequence, or 0 if the journal is not open or has failed and
+        // nothing was logged. Once a full group is waiting behind the one being written, the
+        // caller blocks until the flusher takes it, so a slow disk holds at most two groups in
+        // memory instead of growing the buffer without bound.
+        uint64 append(const OrderCommand& command){
+            if(fd_ < 0 || failed()){
+                return 0;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            space_.wait(lock, [&](){ return buffer_.size() < recordSize * maxBatch_ || failed(); });
+            if(failed()){
+                return 0;
+            }
+            size_t offset = buffer_.size();
+            buffer_.resize(offset + recordSize);
+            unsigned char* record = buffer_.data() + offset;
+            putLE(record, ++sequence_, 8);
+            record[8] = static_cast<unsigned char>(command.type);
+            record[9] = static_cast<unsigned char>(command.orderType);
+            record[10] = command.side == Side::Buy ? 0 : 1;
+            record[11] = static_cast<unsigned char>(command.stopType);
+            putLE(record + 12, command.orderId, 4);
+            putLE(record + 16, command.type == CommandType::New ? static_cast<uint32>(command.stopPrice) : command.origOrderId, 4);
+            putLE(record + 20, static_cast<uint32>(command.price), 4);
+            if(command.type == CommandType::MassCancel){
+                const CancelScope& scope = command.scope;
+                record[9] = scope.ownSession ? 6 : 7;
+                record[10] = !scope.oneSide ? 0 : scope.side == Side::Buy ? 1 : 2;
+                putLE(record + 16, static_cast<uint32>(scope.high), 4);
+                putLE(record + 20, static_cast<uint32>(scope.low), 4);
+            }
+            putLE(record + 24, command.quantity, 4);
+            std::memcpy(record + 28, command.session.name, sizeof(command.session.name));
+            putLE(record + 44, checksum(record), 4);
+            bool full = buffer_.size() == recordSize * maxBatch_;
+            lock.unlock();
+            if(full || offset == 0){
+                wake_.notify_one();
+            }
+            return sequence_;
+        }
+
+        // Blocks until every record appended so far is on disk. Returns false if the journal
+        // has failed.
+        bool commit(){
+            if(fd_ < 0){
+                return !failed();
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            uint64 target = sequence_;
+            waiters_++;
+            wake_.notify_one();
+            committed_.wait(lock, [&](){ return durable_ >= target || failed(); });
+            waiters_--;
+            return !failed();
+        }
+
+private:
+        // Returns 0 or the errno of the failed write or sync.
+        int Write(const std::vector<unsigned char>& data){
+            size_t written = 0;
+            while(written < data.size()){
+                ssize_t n = ::write(fd_, data.data() + written, data.size() - written);
+                if(n < 0 && errno == EINTR){
+                    continue;
+                }
+                if(n <= 0){
+                    return n < 0 ? errno : EIO;
+                }
+                written += static_cast<size_t>(n);
+            }
+            return ::fdatasync(fd_) == 0 ? 0 : errno;
+        }
+
+        // The flusher sleeps until the first record of a group arrives, gives the group up to
+        // maxDelay to fill, then writes and syncs it outside the lock while appends carry on
+        // into the other buffer.
+        void Flush(){
+            std::unique_lock<std::mutex> lock(mutex_);
+            while(true){
+                wake_.wait(lock, [&](){ return stopping_ || !buffer_.empty(); });
+                if(buffer_.empty()){
+                    return;
+                }
+                wake_.wait_for(lock, maxDelay_, [&](){ return stopping_ || waiters_ > 0 || buffer_.size() >= recordSize * maxBatch_; });
+                buffer_.swap(flushing_);
+                uint64 last = sequence_;
+                space_.notify_one();
+                lock.unlock();
+                int error = Write(flushing_);
+                flushing_.clear();
+                lock.lock();
+                if(error != 0){
+                    error_ = error;
+                    failed_.store(true, std::memory_order_release);
+                    committed_.notify_all();
+                    space_.notify_one();
+                    return;
+                }
+                durable_ = last;
+                commits_++;
+                committed_.notify_all();
+            }
+        }
+};
+
+constexpr size_t cacheLine = 64;
+
+// Bounded single-producer/single-consumer ring. Head and tail sit on their own cache lines
+// and each side keeps a cached copy of the other's index, so the shared lines are only
+// touched when the ring looks full or empty.
+template<typename T>
+class SpscQueue{
+private:
+    std::vector<T> slots_;
+    uint64 mask_;
+    alignas(cacheLine) std::atomic<uint64> head_{0};
+    alignas(cacheLine) uint64 cachedTail_ = 0;
+    alignas(cacheLine) std::atomic<uint64> tail_{0};
+    alignas(cacheLine) uint64 cachedHead_ = 0;
+
+public:
+    explicit SpscQueue(uint32 capacity):
+        slots_ (std::size_t{1} << (capacity <= 1 ? 1 : 64 - __builtin_clzll(capacity - 1))),
+        mask_ (slots_.size() - 1)
+        {}
+
+        bool tryPush(const T& item){
+            uint64 tail = tail_.load(std::memory_order_relaxed);
+            if(tail - cachedHead_ == slots_.size()){
+                cachedHead_ = head_.load(std::memory_order_acquire);
+                if(tail - cachedHead_ == slots_.size()){
+                    return false;
+                }
+            }
+            slots_[tail & mask_] = item;
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool tryPop(T& item){
+            uint64 head = head_.load(std::memory_order_relaxed);
+            if(head == cachedTail_){
+                cachedTail_ = tail_.load(std::memory_order_acquire);
+                if(head == cachedTail_){
+                    return false;
+                }
+            }
+            item = slots_[head & mask_];
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool empty() const {
+            return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+        }
+};
+
+// Largest value in a dense array, four lanes at a time where SSE2 is available.
+inline uint32 MaxOf(const uint32* values, size_t count){
+    uint32 largest = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    // SSE2 only compares signed lanes, so both sides are biased by 2^31 first.
+    const __m128i bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+    __m128i best = bias;
+    for(; i + 4 <= count; i += 4){
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)), bias);
+        __m128i greater = _mm_cmpgt_epi32(v, best);
+        best = _mm_or_si128(_mm_and_si128(greater, v), _mm_andnot_si128(greater, best));
+    }
+    alignas(16) uint32 lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), _mm_xor_si128(best, bias));
+    largest = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+    for(; i < count; i++){
+        largest = std::max(largest, values[i]);
+    }
+    return largest;
+}
+
+// Scales values to bar lengths of 0..width relative to largest, rounding to nearest.
+inline void ScaleBars(const uint32* values, uint32* bars, size_t count, uint32 largest, uint32 width){
+    if(largest == 0){
+        std::fill(bars, bars + count, 0u);
+        return;
+    }
+    float scale = static_cast<float>(width) / largest;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 factor = _mm_set1_ps(scale);
+    const __m128 half = _mm_set1_ps(0.5f);
+    for(; i + 4 <= count; i += 4){
+        __m128 v = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i)));
+        __m128i scaled = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, factor), half));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(bars + i), scaled);
+    }
+#endif
+    for(; i < count; i++){
+        bars[i] = static_cast<uint32>(values[i] * scale + 0.5f);
+    }
+}
+
+// Dense copy of a tick range of the book, one entry per tick from highPrice down to
+// lowPrice. Vectors keep their capacity between snapshots.
+struct DomSnapshot{
+    Tick highPrice = 0;
+    Tick lowPrice = 0;
+    Tick midPrice = 0;
+    std::vector<uint32> volume;
+    std::vector<uint32> bids;
+    std::vector<uint32> asks;
+
+    size_t size() const { return volume.size(); }
+};
+
+// Renders a DomSnapshot into one reusable buffer and writes it out with a single call.
+class DomRenderer{
+private:
+    static constexpr uint32 barWidth = 25;
+
+    std::string buffer_;
+    std::vector<uint32> bars_;
+    char number_[32];
+
+    void pad(size_t width, size_t used){
+        if(used < width){
+            buffer_.append(width - used, ' ');
+        }
+    }
+
+    size_t appendUint(uint32 value){
+        char* end = std::to_chars(number_, number_ + sizeof(number_), value).ptr;
+        buffer_.append(number_, end);
+        return static_cast<size_t>(end - number_);
+    }
+
+    size_t appendPrice(Tick price, const ContractSpec& contract){
+        std::string_view text = contract.format(price, number_);
+        buffer_.append(text);
+        return text.size();
+    }
+
+public:
+    DomRenderer(){
+        buffer_.reserve(1 << 16);
+    }
+
+        const std::string& Render(const DomSnapshot& dom, const ContractSpec& contract){
+            buffer_.clear();
+            bars_.resize(dom.size());
+            ScaleBars(dom.volume.data(), bars_.data(), dom.size(), MaxOf(dom.volume.data(), dom.size()), barWidth);
+
+            buffer_.append(10, ' ');
+            buffer_.append("Volume");
+            pad(20, 6);
+            buffer_.append("Price");
+            pad(15, 5);
+            buffer_.append("Bids");
+            pad(15, 4);
+            buffer_.append("Asks\n");
+
+            for(size_t row = 0; row < dom.size(); row++){
+                Tick price = dom.highPrice - static_cast<Tick>(row);
+                if(price == dom.midPrice){
+                    buffer_.append("\033[1;33m");
+                    buffer_.append(22, ' ');
+                    buffer_.append("========");
+                    appendPrice(price, contract);
+                    buffer_.append("========\033[0m\n");
+                }
+                pad(5, appendUint(dom.volume[row]));
+                buffer_.append(barWidth - bars_[row], ' ');
+                for(uint32 bar = 0; bar < bars_[row]; bar++){
+                    buffer_.append("\033[1;34m█\033[0m");
+                }
+                pad(15, appendPrice(price, contract));
+                buffer_.append("\033[1;32m");
+                pad(15, dom.bids[row] ? appendUint(dom.bids[row]) : 0);
+                buffer_.append("\033[0m");
+                if(dom.asks[row]){
+                    buffer_.append("\033[1;31m");
+                    appendUint(dom.asks[row]);
+                    buffer_.append("\033[0m");
+                }
+                buffer_.push_back('\n');
+            }
+            return buffer_;
+        }
+
+        void Write(int fd = STDOUT_FILENO){
+            size_t written = 0;
+            while(written < buffer_.size()){
+                ssize_t n = ::write(fd, buffer_.data() + written, buffer_.size() - written);
+                if(n <= 0){
+                    return;
+                }
+                written += static_cast<size_t>(n);
+            }
+        }
+};
+
+inline void cpuRelax(){
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+// Pins the calling thread to one core; a negative core leaves it where it is.
+inline bool PinThread(int32 core){
+    if(core < 0){
+        return true;
+    }
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+enum class WaitPolicy{
+    Spin,
+    Backoff
+};
+
+// What a pipeline stage does when its input ring is empty. Spin keeps the core hot for the
+// lowest wake-up latency; Backoff pauses, then yields, then sleeps the longer it stays idle.
+class IdleStrategy{
+private:
+    WaitPolicy policy_;
+    uint32 idle_ = 0;
+
+public:
+    explicit IdleStrategy(WaitPolicy policy):
+        policy_ (policy)
+        {}
+
+        void reset(){
+            idle_ = 0;
+        }
+
+        void idle(){
+            if(policy_ == WaitPolicy::Spin || ++idle_ < 64){
+                cpuRelax();
+            }else if(idle_ < 256){
+                std::this_thread::yield();
+            }else{
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+};
+
+// Where a trade prints when the incoming order's limit is better than the resting price:
+// at the resting price, so the newest order gets the improvement, or
+// at the incoming order's limit, so the resting order does. Market orders always trade at
+// the resting price.
+enum class PriceRule{
+    Resting,
+    Aggressor
+};
+
+// What happens when an incoming order would trade with a resting order of the same session
+// (FIX 49). Orders without a session are never treated as self-trades.
+enum class SelfTrade{
+    Allow,
+    CancelResting,
+    CancelAggressor,
+    DecrementBoth
+};
+
+// Pre-trade checks every session's account is held to, plus the self-trade rule. Open
+// quantity counts resting orders and pending stops; the price distance is how many ticks
+// through the best opposite price an order may be. A zero limit is not checked.
+struct RiskLimits{
+    uint32 maxOrderQuantity = 0;
+    uint64 maxOpenQuantity = 0;
+    uint32 maxPriceDistance = 0;
+    SelfTrade selfTrade = SelfTrade::Allow;
+
+    // Parses "size=100,open=1000,distance=40,stp=cancel-resting"; any key may be left out.
+    static bool parse(std::string_view spec, RiskLimits& limits){
+        limits = RiskLimits{};
+        while(!spec.empty()){
+            size_t comma = spec.find(',');
+            std::string_view item = spec.substr(0, comma);
+            spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+            size_t eq = item.find('=');
+            if(eq == std::string_view::npos){
+                return false;
+            }
+            std::string_view key = item.substr(0, eq);
+            std::string_view value = item.substr(eq + 1);
+            uint32 number = 0;
+            if(key == "stp"){
+                if(value == "allow"){
+                    limits.selfTrade = SelfTrade::Allow;
+                }else if(value == "cancel-resting"){
+                    limits.selfTrade = SelfTrade::CancelResting;
+                }else if(value == "cancel-aggressor"){
+                    limits.selfTrade = SelfTrade::CancelAggressor;
+                }else if(value == "decrement"){
+                    limits.selfTrade = SelfTrade::DecrementBoth;
+                }else{
+                    return false;
+                }
+            }else if(!parseUint(value, number)){
+                return false;
+            }else if(key == "size"){
+                limits.maxOrderQuantity = number;
+            }else if(key == "open"){
+                limits.maxOpenQuantity = number;
+            }else if(key == "distance"){
+                limits.maxPriceDistance = number;
+            }else{
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// Interns session names (FIX 49) into dense ids, 0 for no name, through a fixed open-addressed
+// table, so an order carries a u32 rather than the name. Once capacity names are known any
+// further name gets id 0.
+class SessionTable{
+private:
+    std::vector<Symbol> names_;
+    std::vector<uint32> slots_;
+    uint32 mask_ = 0;
+    uint32 capacity_;
+
+    uint32 probe(std::string_view name) const {
+        uint32 idx = static_cast<uint32>(fnv1a(reinterpret_cast<const unsigned char*>(name.data()), name.size())) & mask_;
+        while(slots_[idx] != 0 && names_[slots_[idx]].view() != name){
+            idx = (idx + 1) & mask_;
+        }
+        return idx;
+    }
+
+public:
+    static constexpr uint32 defaultCapacity = 4096;
+
+    explicit SessionTable(uint32 capacity = defaultCapacity):
+        names_ (1),
+        capacity_ (capacity)
+        {
+            uint32 size = 2;
+            while(size < 2 * capacity){
+                size <<= 1;
+            }
+            slots_.resize(size);
+            mask_ = size - 1;
+            names_.reserve(capacity + 1);
+        }
+
+        uint32 size() const { return static_cast<uint32>(names_.size() - 1); }
+        const Symbol& name(uint32 session) const { return names_[session]; }
+
+        uint32 intern(const Symbol& name){
+            if(name.empty()){
+                return 0;
+            }
+            uint32 idx = probe(name.view());
+            if(slots_[idx] == 0){
+                if(size() == capacity_){
+                    return 0;
+                }
+                slots_[idx] = size() + 1;
+                names_.push_back(name);
+            }
+            return slots_[idx];
+        }
+};
+
+class Orderbook{
+
+private:
+
+    struct LevelStat{
+        
+        uint32 volume = 0;
+        uint32 openBids = 0;
+        uint32 openAsks = 0;
+        uint32 publishedBids = 0;
+        uint32 publishedAsks = 0;
+        bool dirty = false;
+    };
+
+    static constexpr uint32 ladderSize = LevelBitmap::capacity;
+
+    std::vector<OrderQueue> bids_;
+    std::vector<OrderQueue> asks_;
+    std::vector<LevelStat> levelStats_;
+    LevelBitmap bidLevels_;
+    LevelBitmap askLevels_;
+    std::vector<OrderQueue> buyStops_;
+    std::vector<OrderQueue> sellStops_;
+    LevelBitmap buyStopLevels_;
+    LevelBitmap sellStopLevels_;
+    uint32 stopCount_ = 0;
+    std::vector<Order> triggered_;
+    size_t nextTriggered_ = 0;
+    Tick lastTrade_ = 0;
+    bool traded_ = false;
+    Tick tradeHigh_ = std::numeric_limits<Tick>::min();
+    Tick tradeLow_ = std::numeric_limits<Tick>::max();
+    PriceRule priceRule_ = PriceRule::Resting;
+    ContractSpec contract_;
+    Tick anchor_ = 0;
+    bool anchored_ = false;
+    OrderPool pool_;
+    OrderIndex orders_;
+    SessionTable sessions_;
+    RiskLimits risk_;
+    std::vector<uint64> accountOpen_;
+    std::vector<uint32> cancelled_;
+    EventRing<ExecutionReport> reports_;
+    EventRing<DepthUpdate> depth_;
+    std::vector<uint32> dirtyLevels_;
+    uint64 depthSequence_ = 0;
+    TradeStore trades_;
+    bool populated_ = false;
+    Journal* journal_ = nullptr;
+    EngineStats stats_;
+    DomSnapshot dom_;
+    DomRenderer domRenderer_;
+
+    uint32 levelIndex(Tick price) const { return static_cast<uint32>(price - anchor_); }
+    Tick bestBid() const { return anchor_ + static_cast<Tick>(bidLevels_.highest()); }
+    Tick bestAsk() const { return anchor_ + static_cast<Tick>(askLevels_.lowest()); }
+
+    bool inLadder(Tick price) const {
+        return anchored_ && price >= anchor_ && price - anchor_ < static_cast<Tick>(ladderSize);
+    }
+
+    void Report(ExecType type, const Order& order, Tick price, uint32 quantity, RejectReason reason = RejectReason::None){
+        stats_.count(type);
+        reports_.push(ExecutionReport{type, reason, order.getSide(), order.getOrderId(), price, quantity, order.getRemaining(),
+            order.getOrderType(), order.getStopType()});
+    }
+
+    // A triggered Stop carries the market sentinel as its limit, so its kill reports the stop
+    // price instead.
+    static Tick killPrice(const Order& order){
+        return order.getStopType() == StopType::Stop ? order.getStopPrice() : order.getPrice();
+    }
+
+    uint32& openQuantity(Side side, uint32 lvl){
+        LevelStat& stat = levelStats_[lvl];
+        if(!stat.dirty){
+            stat.dirty = true;
+            dirtyLevels_.push_back(lvl);
+        }
+        return side == Side::Buy ? stat.openBids : stat.openAsks;
+    }
+
+    void PublishLevel(Side side, uint32 lvl, uint32 open, uint32& published){
+        if(open == published){
+            return;
+        }
+        DepthAction action = published == 0 ? DepthAction::Add : open == 0 ? DepthAction::Delete : DepthAction::Update;
+        depth_.push(DepthUpdate{++depthSequence_, anchor_ + static_cast<Tick>(lvl), open, side, action});
+        published = open;
+    }
+
+    // Turns every level touched since the last call into one add/update/delete, so a command
+    // that hits the same level many times publishes it once with its final size.
+    void CollectDepth(){
+        auto span = stats_.time(Stage::Depth);
+        for(uint32 lvl : dirtyLevels_){
+            LevelStat& stat = levelStats_[lvl];
+            stat.dirty = false;
+            PublishLevel(Side::Buy, lvl, stat.openBids, stat.publishedBids);
+            PublishLevel(Side::Sell, lvl, stat.openAsks, stat.publishedAsks);
+        }
+        dirtyLevels_.clear();
+    }
+
+    void Reject(uint32 orderId, RejectReason reason){
+        stats_.count(ExecType::Reject);
+        reports_.push(ExecutionReport{ExecType::Reject, reason, Side::Buy, orderId, 0, 0, 0, OrderType::GoodTillFill, StopType::None});
+    }
+
+    template<Side side>
+    LevelBitmap& levels(){
+        if constexpr (side == Side::Buy){
+            return bidLevels_;
+        }else{
+            return askLevels_;
+        }
+    }
+
+    template<Side side>
+    const LevelBitmap& levels() const {
+        if constexpr (side == Side::Buy){
+            return bidLevels_;
+        }else{
+            return askLevels_;
+        }
+    }
+
+    template<Side side>
+    std::vector<OrderQueue>& queues(){
+        if constexpr (side == Side::Buy){
+            return bids_;
+        }else{
+            return asks_;
+        }
+    }
+
+    template<Side side>
+    const std::vector<OrderQueue>& queues() const {
+        if constexpr (side == Side::Buy){
+            return bids_;
+        }else{
+            return asks_;
+        }
+    }
+
+    template<Side side>
+    LevelBitmap& stopLevels(){
+        if constexpr (side == Side::Buy){
+            return buyStopLevels_;
+        }else{
+            return sellStopLevels_;
+        }
+    }
+
+    template<Side side>
+    std::vector<OrderQueue>& stopQueues(){
+        if constexpr (side == Side::Buy){
+            return buyStops_;
+        }else{
+            return sellStops_;
+        }
+    }
+
+    // The best level of a side is its highest bid or its lowest ask.
+    template<Side side>
+    uint32 bestLevel() const {
+        if constexpr (side == Side::Buy){
+            return bidLevels_.highest();
+        }else{
+            return askLevels_.lowest();
+        }
+    }
+
+    // The limit of a market order, which crosses every resting price.
+    template<Side side>
+    static constexpr Tick marketPrice(){
+        return side == Side::Buy ? std::numeric_limits<Tick>::max() : std::numeric_limits<Tick>::min();
+    }
+
+    template<Side side>
+    static bool crosses(Tick price, Tick restingPrice){
+        if constexpr (side == Side::Buy){
+            return price >= restingPrice;
+        }else{
+            return price <= restingPrice;
+        }
+    }
+
+    template<Side side>
+    bool canFill(Tick price) const {
+        constexpr Side other = opposite(side);
+        return !levels<other>().empty() && crosses<side>(price, anchor_ + static_cast<Tick>(bestLevel<other>()));
+    }
+
+    // Calls handler with the side and order type as compile-time constants, so everything
+    // below the entry points is instantiated once per combination.
+    template<typename Handler>
+    static void Dispatch(Side side, OrderType orderType, Handler&& handler){
+        using Buy = std::integral_constant<Side, Side::Buy>;
+        using Sell = std::integral_constant<Side, Side::Sell>;
+        using GoodTillFill = std::integral_constant<OrderType, OrderType::GoodTillFill>;
+        using FillOrKill = std::integral_constant<OrderType, OrderType::FillOrKill>;
+        using ImmediateOrCancel = std::integral_constant<OrderType, OrderType::ImmediateOrCancel>;
+        auto withType = [&](auto sideTag){
+            switch(orderType){
+            case OrderType::GoodTillFill: handler(sideTag, GoodTillFill{}); break;
+            case OrderType::FillOrKill: handler(sideTag, FillOrKill{}); break;
+            case OrderType::ImmediateOrCancel: handler(sideTag, ImmediateOrCancel{}); break;
+            }
+        };
+        if(side == Side::Buy){
+            withType(Buy{});
+        }else{
+            withType(Sell{});
+        }
+    }
+
+    // Adds up the open quantity on the opposite side that an order at price could reach,
+    // stopping as soon as quantity is covered. Reads level totals only, never the queues.
+    template<Side side>
+    uint32 available(Tick price, uint32 quantity) const {
+        constexpr Side other = opposite(side);
+        const LevelBitmap& resting = levels<other>();
+        uint32 total = 0;
+        if(resting.empty()){
+            return 0;
+        }
+        for(uint32 lvl = bestLevel<other>(); lvl != ladderSize && total < quantity; lvl = other == Side::Buy ? resting.below(lvl) : resting.above(lvl)){
+            if(!crosses<side>(price, anchor_ + static_cast<Tick>(lvl))){
+                break;
+            }
+            const LevelStat& stat = levelStats_[lvl];
+            total += other == Side::Buy ? stat.openBids : stat.openAsks;
+        }
+        return std::min(total, quantity);
+    }
+
+    // What a FillOrKill of session can really fill once self-trade prevention has run: orders
+    // of its own session are skipped when they would be cancelled, and otherwise end the walk,
+    // since meeting one cuts the aggressor down without a fill. Walks the queues, so it is only
+    // used when a self-trade is possible.
+    template<Side side>
+    uint32 availableTo(uint32 session, Tick price, uint32 quantity) const {
+        constexpr Side other = opposite(side);
+        const LevelBitmap& resting = levels<other>();
+        uint32 total = 0;
+        if(resting.empty()){
+            return 0;
+        }
+        for(uint32 lvl = bestLevel<other>(); lvl != ladderSize && total < quantity; lvl = other == Side::Buy ? resting.below(lvl) : resting.above(lvl)){
+            if(!crosses<side>(price, anchor_ + static_cast<Tick>(lvl))){
+                break;
+            }
+            for(OrderHandle handle = queues<other>()[lvl].head; handle != nullHandle && total < quantity; handle = pool_.next(handle)){
+                const Order& order = pool_[handle];
+                if(order.getSession() != session){
+                    total += order.getRemaining();
+                }else if(risk_.selfTrade != SelfTrade::CancelResting){
+                    return std::min(total, quantity);
+                }
+            }
+        }
+        return std::min(total, quantity);
+    }
+
+    template<Side side>
+    void Rest(OrderHandle handle){
+        Order& order = pool_[handle];
+        uint32 lvl = levelIndex(order.getPrice());
+        pool_.pushBack(queues<side>()[lvl], handle);
+        levels<side>().set(lvl);
+        openQuantity(side, lvl) += order.getRemaining();
+        accountOpen_[order.getSession()] += order.getRemaining();
+    }
+
+    template<Side side>
+    void Unrest(OrderHandle handle){
+        const Order& order = pool_[handle];
+        uint32 lvl = levelIndex(order.getPrice());
+        openQuantity(side, lvl) -= order.getRemaining();
+        accountOpen_[order.getSession()] -= order.getRemaining();
+        OrderQueue& queue = queues<side>()[lvl];
+        pool_.unlink(queue, handle);
+        if(queue.empty()){
+            levels<side>().reset(lvl);
+        }
+    }
+
+    // Matches a pooled GoodTillFill order against the opposite side and rests whatever is left.
+    template<Side side>
+    void Place(OrderHandle handle){
+        Order& order = pool_[handle];
+        if(canFill<side>(order.getPrice())){
+            Fill<side>(order);
+            if(order.getRemaining() == 0){
+                orders_.erase(order.getOrderId());
+                pool_.release(handle);
+                return;
+            }
+        }
+        Rest<side>(handle);
+    }
+
+    // Walks the opposite side from its best level while the incoming order still crosses,
+    // trading at the resting price in time priority. Fill reports go out bid first.
+    template<Side side>
+    void Fill(Order& aggressor){
+        auto span = stats_.time(Stage::Match);
+        constexpr Side other = opposite(side);
+        uint64 time = static_cast<uint64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        LevelBitmap& restingLevels = levels<other>();
+
+        while(!restingLevels.empty()){
+            uint32 lvl = bestLevel<other>();
+            Tick price = anchor_ + static_cast<Tick>(lvl);
+            if(!crosses<side>(aggressor.getPrice(), price)){
+                break;
+            }
+            Tick tradePrice = price;
+            if(priceRule_ == PriceRule::Aggressor && aggressor.getPrice() != marketPrice<side>()){
+                tradePrice = aggressor.getPrice();
+            }
+            OrderQueue& queue = queues<other>()[lvl];
+            while(!queue.empty()){
+                OrderHandle restingHandle = queue.head;
+                Order& resting = pool_[restingHandle];
+                uint32 restingId = resting.getOrderId();
+                if(resting.getSession() == aggressor.getSession() && risk_.selfTrade != SelfTrade::Allow && aggressor.getSession() != 0){
+                    PreventSelfTrade<other>(aggressor, queue, restingHandle, lvl, price);
+                    if(aggressor.getRemaining() == 0){
+                        if(queue.empty()){
+                            restingLevels.reset(lvl);
+                        }
+                        return;
+                    }
+                    continue;
+                }
+                uint32 quantity = std::min(aggressor.getRemaining(), resting.getRemaining());
+
+                aggressor.fillOrder(quantity);
+                resting.fillOrder(quantity);
+                levelStats_[lvl].volume += quantity;
+                openQuantity(other, lvl) -= quantity;
+                accountOpen_[resting.getSession()] -= quantity;
+                lastTrade_ = tradePrice;
+                traded_ = true;
+                tradeHigh_ = std::max(tradeHigh_, tradePrice);
+                tradeLow_ = std::min(tradeLow_, tradePrice);
+                if constexpr (side == Side::Buy){
+                    trades_.record(time, tradePrice, quantity, aggressor.getOrderId(), restingId, side);
+                    Report(ExecType::Fill, aggressor, tradePrice, quantity);
+                    Report(ExecType::Fill, resting, tradePrice, quantity);
+                }else{
+                    trades_.record(time, tradePrice, quantity, restingId, aggressor.getOrderId(), side);
+                    Report(ExecType::Fill, resting, tradePrice, quantity);
+                    Report(ExecType::Fill, aggressor, tradePrice, quantity);
+                }
+
+                if(resting.getRemaining() == 0){
+                    pool_.unlink(queue, restingHandle);
+                    pool_.release(restingHandle);
+                    orders_.erase(restingId);
+                }
+                if(aggressor.getRemaining() == 0){
+                    if(queue.empty()){
+                        restingLevels.reset(lvl);
+                    }
+                    return;
+                }
+            }
+            restingLevels.reset(lvl);
+        }
+    }
+
+    // An incoming order meets a resting order of its own session. Instead of trading, the
+    // resting order, the incoming order or both by the smaller of their sizes are reduced, and
+    // every order reduced gets a SelfTrade report. A resting order reduced to nothing leaves
+    // the book.
+    template<Side restingSide>
+    void PreventSelfTrade(Order& aggressor, OrderQueue& queue, OrderHandle restingHandle, uint32 lvl, Tick price){
+        Order& resting = pool_[restingHandle];
+        uint32 restingCut = 0;
+        uint32 aggressorCut = 0;
+        switch(risk_.selfTrade){
+        case SelfTrade::CancelResting: restingCut = resting.getRemaining(); break;
+        case SelfTrade::CancelAggressor: aggressorCut = aggressor.getRemaining(); break;
+        default: restingCut = aggressorCut = std::min(aggressor.getRemaining(), resting.getRemaining()); break;
+        }
+        if(restingCut != 0){
+            resting.reduce(restingCut);
+            openQuantity(restingSide, lvl) -= restingCut;
+            accountOpen_[resting.getSession()] -= restingCut;
+            Report(ExecType::SelfTrade, resting, price, restingCut);
+            if(resting.getRemaining() == 0){
+                orders_.erase(resting.getOrderId());
+                pool_.unlink(queue, restingHandle);
+                pool_.release(restingHandle);
+            }
+        }
+        if(aggressorCut != 0){
+            aggressor.reduce(aggressorCut);
+            Report(ExecType::SelfTrade, aggressor, price, aggressorCut);
+        }
+    }
+
+    // Checks an order against the limits of its session's account before it reaches the book.
+    // addedOpen is how much it would add to the account's open quantity, and only limit orders
+    // are held to the price distance.
+    RejectReason CheckRisk(uint32 session, Side side, Tick price, uint32 quantity, uint64 addedOpen, bool limitPrice) const {
+        if(risk_.maxOrderQuantity != 0 && quantity > risk_.maxOrderQuantity){
+            return RejectReason::RiskOrderSize;
+        }
+        if(risk_.maxOpenQuantity != 0 && accountOpen_[session] + addedOpen > risk_.maxOpenQuantity){
+            return RejectReason::RiskOpenQuantity;
+        }
+        if(risk_.maxPriceDistance != 0 && limitPrice){
+            int64 distance = risk_.maxPriceDistance;
+            if(side == Side::Buy ? hasAsks() && int64(price) > int64(bestAsk()) + distance : hasBids() && int64(price) < int64(bestBid()) - distance){
+                return RejectReason::RiskPriceDistance;
+            }
+        }
+        return RejectReason::None;
+    }
+
+    // Pending stops hang off the same tick ladder as the book, FIFO per stop price.
+    template<Side side>
+    void Arm(OrderHandle handle){
+        const Order& order = pool_[handle];
+        uint32 lvl = levelIndex(order.getStopPrice());
+        pool_.pushBack(stopQueues<side>()[lvl], handle);
+        stopLevels<side>().set(lvl);
+        stopCount_++;
+        accountOpen_[order.getSession()] += order.getRemaining();
+    }
+
+    template<Side side>
+    void Disarm(OrderHandle handle){
+        const Order& order = pool_[handle];
+        uint32 lvl = levelIndex(order.getStopPrice());
+        OrderQueue& queue = stopQueues<side>()[lvl];
+        pool_.unlink(queue, handle);
+        if(queue.empty()){
+            stopLevels<side>().reset(lvl);
+        }
+        stopCount_--;
+        accountOpen_[order.getSession()] -= order.getRemaining();
+    }
+
+    // A buy stop triggers on a trade at or above its stop price and a sell stop on a trade at
+    // or below it. Every pending stop is still beyond all trades since it was armed, so only
+    // the levels up to the high (buys) or down to the low (sells) of the trades since the last
+    // call are visited. Triggered stops are queued nearest stop price first, FIFO per level.
+    template<Side side>
+    void Trigger(){
+        LevelBitmap& armed = stopLevels<side>();
+        while(!armed.empty()){
+            uint32 lvl = side == Side::Buy ? armed.lowest() : armed.highest();
+            Tick stopPrice = anchor_ + static_cast<Tick>(lvl);
+            if(side == Side::Buy ? stopPrice > tradeHigh_ : stopPrice < tradeLow_){
+                return;
+            }
+            OrderQueue& queue = stopQueues<side>()[lvl];
+            while(!queue.empty()){
+                OrderHandle handle = queue.head;
+                pool_.unlink(queue, handle);
+                triggered_.push_back(pool_[handle]);
+                orders_.erase(pool_[handle].getOrderId());
+                accountOpen_[pool_[handle].getSession()] -= pool_[handle].getRemaining();
+                pool_.release(handle);
+                stopCount_--;
+            }
+            armed.reset(lvl);
+        }
+    }
+
+    // Feeds triggered stops back into the book one at a time, checking the trades each one
+    // makes for further triggers, until the cascade settles. Stops triggered by the same
+    // trades enter in the order Trigger queued them, buys before sells. A Stop enters as a
+    // market order: ImmediateOrCancel (or FillOrKill) with no price limit.
+    void ReleaseStops(){
+        while(true){
+            if(tradeHigh_ >= tradeLow_){
+                Trigger<Side::Buy>();
+                Trigger<Side::Sell>();
+                tradeHigh_ = std::numeric_limits<Tick>::min();
+                tradeLow_ = std::numeric_limits<Tick>::max();
+            }
+            if(nextTriggered_ == triggered_.size()){
+                break;
+            }
+            const Order stop = triggered_[nextTriggered_++];
+            Report(ExecType::Trigger, stop, stop.getStopPrice(), stop.getQuantity());
+            OrderType orderType = stop.getOrderType();
+            Tick price = stop.getPrice();
+            if(stop.getStopType() == StopType::Stop){
+                orderType = orderType == OrderType::FillOrKill ? OrderType::FillOrKill : OrderType::ImmediateOrCancel;
+                price = stop.getSide() == Side::Buy ? marketPrice<Side::Buy>() : marketPrice<Side::Sell>();
+            }
+            Order order = Order::fromTicks(orderType, stop.getSide(), stop.getOrderId(), price, stop.getQuantity());
+            order.setSession(stop.getSession());
+            // A stop market order never rests, so it keeps its stop type only to name itself
+            // in its kill report.
+            if(stop.getStopType() == StopType::Stop){
+                order.setStop(StopType::Stop, stop.getStopPrice());
+            }
+            Dispatch(order.getSide(), orderType, [&](auto side, auto type){
+                Add<decltype(side)::value, decltype(type)::value>(order, true);
+            });
+        }
+        triggered_.clear();
+        nextTriggered_ = 0;
+    }
+
+    // A stop the last trade has already reached triggers straight away. Anything else is pooled
+    // and indexed like a resting order, so it can be cancelled or replaced while it waits.
+    void AddStop(const Order& order){
+        if (orders_.find(order.getOrderId()) != nullHandle){
+            Report(ExecType::Reject, order, order.getPrice(), order.getQuantity(), RejectReason::DuplicateOrderId);
+            return;
+        }
+        Tick stopPrice = order.getStopPrice();
+        if (traded_ && (order.getSide() == Side::Buy ? lastTrade_ >= stopPrice : lastTrade_ <= stopPrice)){
+            Report(ExecType::Ack, order, order.getPrice(), order.getQuantity());
+            triggered_.push_back(order);
+            return;
+        }
+        if (!ensureLevel(stopPrice)){
+            Report(ExecType::Reject, order, order.getPrice(), order.getQuantity(), RejectReason::PriceOutOfRange);
+            return;
+        }
+
+        OrderHandle handle = pool_.allocate(order);
+        if (handle == nullHandle){
+            Report(ExecType::Reject, order, order.getPrice(), order.getQuantity(), RejectReason::PoolExhausted);
+            return;
+        }
+
+        Report(ExecType::Ack, pool_[handle], order.getPrice(), order.getQuantity());
+        orders_.insert(order.getOrderId(), handle);
+        if (order.getSide() == Side::Buy){
+            Arm<Side::Buy>(handle);
+        }else {
+            Arm<Side::Sell>(handle);
+        }
+    }
+
+    // Releases the orders of one level, or only those of session when bySession is set, and
+    // queues their ids for a batched erase from the index. Returns the open quantity removed.
+    uint64 CancelLevel(OrderQueue& queue, bool bySession, uint32 session, uint32& count){
+        uint64 open = 0;
+        for(OrderHandle handle = queue.head; handle != nullHandle;){
+            OrderHandle next = pool_.next(handle);
+            const Order& order = pool_[handle];
+            if(!bySession || order.getSession() == session){
+                if(bySession){
+                    pool_.unlink(queue, handle);
+                }
+                cancelled_.push_back(order.getOrderId());
+                open += order.getRemaining();
+                accountOpen_[order.getSession()] -= order.getRemaining();
+                count++;
+                pool_.release(handle);
+            }
+            handle = next;
+        }
+        if(!bySession){
+            queue = OrderQueue{};
+        }
+        return open;
+    }
+
+    // The ladder is a fixed window of ticks starting at anchor_. When a price falls outside
+    // of it the window is recentred over every resting level plus the new price, which only
+    // fails if the book is wider than the whole ladder.
+    bool ensureLevel(Tick price){
+        if(!anchored_){
+            anchor_ = price - static_cast<Tick>(ladderSize / 2);
+            anchored_ = true;
+            return true;
+        }
+        if(inLadder(price)){
+            return true;
+        }
+
+        Tick lo = price;
+        Tick hi = price;
+        if(!bidLevels_.empty()){
+            lo = std::min(lo, anchor_ + static_cast<Tick>(bidLevels_.lowest()));
+            hi = std::max(hi, bestBid());
+        }
+        if(!askLevels_.empty()){
+            lo = std::min(lo, bestAsk());
+            hi = std::max(hi, anchor_ + static_cast<Tick>(askLevels_.highest()));
+        }
+        for(const LevelBitmap* stops : {&buyStopLevels_, &sellStopLevels_}){
+            if(!stops -> empty()){
+                lo = std::min(lo, anchor_ + static_cast<Tick>(stops -> lowest()));
+                hi = std::max(hi, anchor_ + static_cast<Tick>(stops -> highest()));
+            }
+        }
+        if(hi - lo >= static_cast<Tick>(ladderSize)){
+            return false;
+        }
+
+        shiftLadder(lo - (static_cast<Tick>(ladderSize) - 1 - (hi - lo)) / 2);
+        return true;
+    }
+
+    void shiftLadder(Tick newAnchor){
+        CollectDepth();
+        Tick delta = newAnchor - anchor_;
+        anchor_ = newAnchor;
+
+        // Rungs shifted out of the window never hold resting orders, only old traded volume.
+        if(std::abs(delta) >= static_cast<Tick>(ladderSize)){
+            std::fill(levelStats_.begin(), levelStats_.end(), LevelStat{});
+            return;
+        }
+        if(delta > 0){
+            std::rotate(bids_.begin(), bids_.begin() + delta, bids_.end());
+            std::rotate(asks_.begin(), asks_.begin() + delta, asks_.end());
+            std::rotate(buyStops_.begin(), buyStops_.begin() + delta, buyStops_.end());
+            std::rotate(sellStops_.begin(), sellStops_.begin() + delta, sellStops_.end());
+            std::rotate(levelStats_.begin(), levelStats_.begin() + delta, levelStats_.end());
+            std::fill(levelStats_.end() - delta, levelStats_.end(), LevelStat{});
+        }else{
+            std::rotate(bids_.begin(), bids_.end() + delta, bids_.end());
+            std::rotate(asks_.begin(), asks_.end() + delta, asks_.end());
+            std::rotate(buyStops_.begin(), buyStops_.end() + delta, buyStops_.end());
+            std::rotate(sellStops_.begin(), sellStops_.end() + delta, sellStops_.end());
+            std::rotate(levelStats_.begin(), levelStats_.end() + delta, levelStats_.end());
+            std::fill(levelStats_.begin(), levelStats_.begin() - delta, LevelStat{});
+        }
+
+        bidLevels_.clear();
+        askLevels_.clear();
+        buyStopLevels_.clear();
+        sellStopLevels_.clear();
+        for(uint32 i = 0; i < ladderSize; i++){
+            if(!bids_[i].empty()){
+                bidLevels_.set(i);
+            }
+            if(!asks_[i].empty()){
+                askLevels_.set(i);
+            }
+            if(!buyStops_[i].empty()){
+                buyStopLevels_.set(i);
+            }
+            if(!sellStops_[i].empty()){
+                sellStopLevels_.set(i);
+            }
+        }
+    }
+
+public:
+    using ReportSink = std::function<void(const ExecutionReport&)>;
+    using DepthSink = std::function<void(const DepthUpdate&)>;
+
+    static constexpr uint32 defaultOrderCapacity = 1 << 18;
+    static constexpr uint32 defaultReportCapacity = 1 << 16;
+
+    explicit Orderbook(uint32 orderCapacity = defaultOrderCapacity, uint32 reportCapacity = defaultReportCapacity):
+        bids_ (ladderSize),
+        asks_ (ladderSize),
+        levelStats_ (ladderSize),
+        buyStops_ (ladderSize),
+        sellStops_ (ladderSize),
+        pool_ (orderCapacity),
+        orders_ (orderCapacity),
+        accountOpen_ (SessionTable::defaultCapacity + 1),
+        reports_ (reportCapacity),
+        depth_ (reportCapacity)
+        {
+            dirtyLevels_.reserve(ladderSize);
+            triggered_.reserve(1024);
+        }
+
+    bool hasBids() const { return !bidLevels_.empty(); }
+    bool hasAsks() const { return !askLevels_.empty(); }
+    Tick getBestBid() const { return bestBid(); }
+    Tick getBestAsk() const { return bestAsk(); }
+    uint32 getOrderCount() const { return pool_.size() - stopCount_; }
+    uint32 getStopCount() const { return stopCount_; }
+    uint32 getOrderCapacity() const { return pool_.capacity(); }
+    uint64 getDroppedReports() const { return reports_.getDropped(); }
+    uint64 getDroppedDepth() const { return depth_.getDropped(); }
+    const TradeStore& getTrades() const { return trades_; }
+    PriceRule getPriceRule() const { return priceRule_; }
+    const ContractSpec& getContract() const { return contract_; }
+    const RiskLimits& getRiskLimits() const { return risk_; }
+
+    void setRiskLimits(const RiskLimits& limits){
+        risk_ = limits;
+    }
+
+    // Set before the first order; resting prices are not converted.
+    void setContract(const ContractSpec& contract){
+        contract_ = contract;
+    }
+
+    void setPriceRule(PriceRule rule){
+        priceRule_ = rule;
+    }
+
+    // Copy of the counters and latencies with the current book gauges filled in. Call it
+    // from the thread driving the book, or once that thread is idle.
+    EngineStats getStats() const {
+        EngineStats stats = stats_;
+        stats.setGauges(pool_.size(), pool_.capacity(), bidLevels_.count(), askLevels_.count());
+        stats.setDropped(reports_.getDropped(), depth_.getDropped());
+        return stats;
+    }
+
+    void ResetStats(){
+        stats_.reset();
+    }
+
+    void setStatsSampling(uint32 sampleEvery){
+        stats_.setSampleEvery(sampleEvery);
+    }
+
+    bool SpillTrades(const char* path){
+        return trades_.spillTo(path);
+    }
+
+    // A single command can raise more reports or depth deltas than the rings hold, e.g. a
+    // sweep through thousands of resting orders. With a sink set, overflow goes to the sink
+    // from inside the match loop instead of being dropped; pass the same consumer as to
+    // DrainReports/DrainDepth. Each returns the sink it replaces.
+    ReportSink setReportSink(ReportSink sink){
+        return reports_.setOverflow(std::move(sink));
+    }
+
+    DepthSink setDepthSink(DepthSink sink){
+        return depth_.setOverflow(std::move(sink));
+    }
+
+    bool PollReport(ExecutionReport& report){
+        return reports_.pop(report);
+    }
+
+    template<typename Consumer>
+    void DrainReports(Consumer&& consumer){
+        ExecutionReport report;
+        while(reports_.pop(report)){
+            consumer(report);
+        }
+    }
+
+    // Depth deltas carry consecutive sequence numbers; a gap means the ring overflowed with no
+    // depth sink set and the consumer should resync from GetBookLevels().
+    template<typename Consumer>
+    void DrainDepth(Consumer&& consumer){
+        DepthUpdate update;
+        while(depth_.pop(update)){
+            consumer(update);
+        }
+    }
+
+    BookLevels GetBookLevels(uint32 depth) const {
+        priceLevels bids;
+        priceLevels asks;
+        bids.reserve(depth);
+        asks.reserve(depth);
+        if(!bidLevels_.empty()){
+            for(uint32 lvl = bidLevels_.highest(); lvl != ladderSize && bids.size() < depth; lvl = bidLevels_.below(lvl)){
+                bids.push_back(PriceLevel{anchor_ + static_cast<Tick>(lvl), levelStats_[lvl].publishedBids});
+            }
+        }
+        if(!askLevels_.empty()){
+            for(uint32 lvl = askLevels_.lowest(); lvl != ladderSize && asks.size() < depth; lvl = askLevels_.above(lvl)){
+                asks.push_back(PriceLevel{anchor_ + static_cast<Tick>(lvl), levelStats_[lvl].publishedAsks});
+            }
+        }
+        return BookLevels(bids, asks, depthSequence_);
+    }
+
+    // Stops that trade triggers are entered before this returns.
+    void AddOrder(const Order& order){
+        auto span = stats_.time(Stage::Add);
+        RejectReason status = contract_.check(order.getPrice(), order.getQuantity());
+        if(status == RejectReason::None && order.isStop()){
+            status = contract_.check(order.getStopPrice(), order.getQuantity());
+        }
+        if(status == RejectReason::None){
+            status = CheckRisk(order.getSession(), order.getSide(), order.getPrice(), order.getQuantity(), order.getQuantity(), !order.isStop());
+        }
+        if(status != RejectReason::None){
+            Report(ExecType::Reject, order, order.getPrice(), order.getQuantity(), status);
+            return;
+        }
+        if(order.isStop()){
+            AddStop(order);
+        }else{
+            Dispatch(order.getSide(), order.getOrderType(), [&](auto side, auto orderType){
+                Add<decltype(side)::value, decltype(orderType)::value>(order);
+            });
+        }
+        ReleaseStops();
+    }
+
+    // A triggered stop was acknowledged when it arrived, so it is not acknowledged again.
+    template<Side side, OrderType orderType>
+    void Add(const Order& order, bool triggered = false){
+        
+        if (orders_.find(order.getOrderId()) != nullHandle){
+            Report(ExecType::Reject, order, order.getPrice(), order.getQuantity(), RejectReason::DuplicateOrderId);
+            return;
+        }
+
+
+        // FillOrKill and ImmediateOrCancel never rest, so they trade on a copy that is never
+        // pooled or indexed. The depth they could reach is summed first and an order that can
+        // not trade at all, or a FillOrKill that can not fill completely, is killed untouched.
+        if constexpr (orderType != OrderType::GoodTillFill){
+            if (!triggered){
+                Report(ExecType::Ack, order, order.getPrice(), order.getQuantity());
+            }
+            uint32 reachable = orderType == OrderType::FillOrKill && risk_.selfTrade != SelfTrade::Allow && order.getSession() != 0
+                ? availableTo<side>(order.getSession(), order.getPrice(), order.getQuantity())
+                : available<side>(order.getPrice(), order.getQuantity());
+            if (reachable == 0 || (orderType == OrderType::FillOrKill && reachable < order.getQuantity())){
+                Report(ExecType::Kill, order, killPrice(order), order.getQuantity());
+                return;
+            }
+            Order aggressor = order;
+            Fill<side>(aggressor);
+            if (aggressor.getRemaining() != 0){
+                Report(ExecType::Kill, aggressor, killPrice(aggressor), aggressor.getQuantity());
+            }
+            CollectDepth();
+            return;
+        }
+
+        if (!ensureLevel(order.getPrice())){
+            Report(ExecType::Reject, order, order.getPrice(), order.getQuantity(), RejectReason::PriceOutOfRange);
+            return;
+        }
+
+        OrderHandle handle = pool_.allocate(order);
+        if (handle == nullHandle){
+            Report(ExecType::Reject, order, order.getPrice(), order.getQuantity(), RejectReason::PoolExhausted);
+            return;
+        }
+
+        if (!triggered){
+            Report(ExecType::Ack, pool_[handle], order.getPrice(), order.getQuantity());
+        }
+        orders_.insert(order.getOrderId(), handle);
+        Place<side>(handle);
+        CollectDepth();
+
+    }
+
+    void CancelOrder(uint32 ordId){
+        auto span = stats_.time(Stage::Cancel);
+        OrderHandle handle = orders_.find(ordId);
+        if (handle == nullHandle){
+            Reject(ordId, RejectReason::UnknownOrderId);
+            return;
+        }
+
+        const Order& order = pool_[handle];
+        Report(ExecType::Cancel, order, order.getPrice(), order.getQuantity());
+        orders_.erase(ordId);
+        if (order.isStop()){
+            if (order.getSide() == Side::Buy){
+                Disarm<Side::Buy>(handle);
+            }else {
+                Disarm<Side::Sell>(handle);
+            }
+        }else if (order.getSide() == Side::Buy){
+            Unrest<Side::Buy>(handle);
+        }else {
+            Unrest<Side::Sell>(handle);
+        }
+        pool_.release(handle);
+        CollectDepth();
+
+    }
+
+    // Cancels every order in scope in one pass over the levels the price range covers, on the
+    // book and among the pending stops, with session standing for the sender of the request.
+    // Whole levels are dropped without unlinking order by order, the index is cleaned up in
+    // one batch afterwards, and a single MassCancel report carries the number of orders and
+    // the open quantity cancelled.
+    void MassCancel(uint32 requestId, const CancelScope& scope, uint32 session = 0){
+        auto span = stats_.time(Stage::Cancel);
+        uint32 count = 0;
+        uint64 open = 0;
+        Tick low = std::max(scope.low, anchor_);
+        Tick high = std::min(scope.high, anchor_ + static_cast<Tick>(ladderSize) - 1);
+        auto sweep = [&](auto sideTag){
+            constexpr Side side = decltype(sideTag)::value;
+            if(scope.oneSide && scope.side != side){
+                return;
+            }
+            for(bool stops : {false, true}){
+                LevelBitmap& bits = stops ? stopLevels<side>() : levels<side>();
+                std::vector<OrderQueue>& levelQueues = stops ? stopQueues<side>() : queues<side>();
+                for(uint32 lvl = bits.from(levelIndex(low)); lvl <= levelIndex(high) && lvl != ladderSize; lvl = bits.above(lvl)){
+                    uint32 levelCount = 0;
+                    uint64 levelOpen = CancelLevel(levelQueues[lvl], scope.ownSession, session, levelCount);
+                    if(stops){
+                        stopCount_ -= levelCount;
+                    }else{
+                        openQuantity(side, lvl) -= static_cast<uint32>(levelOpen);
+                    }
+                    if(levelQueues[lvl].empty()){
+                        bits.reset(lvl);
+                    }
+                    count += levelCount;
+                    open += levelOpen;
+                }
+            }
+        };
+        if(anchored_ && low <= high){
+            sweep(std::integral_constant<Side, Side::Buy>{});
+            sweep(std::integral_constant<Side, Side::Sell>{});
+        }
+        for(uint32 orderId : cancelled_){
+            orders_.erase(orderId);
+        }
+        cancelled_.clear();
+        stats_.count(ExecType::MassCancel);
+        reports_.push(ExecutionReport{ExecType::MassCancel, RejectReason::None, scope.side, requestId, 0, count, static_cast<uint32>(open),
+            OrderType::GoodTillFill, StopType::None});
+        CollectDepth();
+    }
+
+    // Cancel/replace. A quantity reduction at the same price is applied to the resting order
+    // where it sits and keeps its queue priority; a new price or a larger quantity sends it to
+    // the back of the queue at its new level. FIX 38 is the new total quantity, so anything
+    // already filled still counts against it. A pending stop keeps its stop price and its
+    // place among the stops, and only takes the new quantity and limit price.
+    void ModifyOrder(uint32 origOrderId, uint32 orderId, Tick price, uint32 quantity){
+        auto span = stats_.time(Stage::Replace);
+        OrderHandle handle = orders_.find(origOrderId);
+        if (handle == nullHandle){
+            Reject(origOrderId, RejectReason::UnknownOrderId);
+            return;
+        }
+        if (orderId != origOrderId && orders_.find(orderId) != nullHandle){
+            Reject(orderId, RejectReason::DuplicateOrderId);
+            return;
+        }
+        RejectReason status = contract_.check(price, quantity);
+        if (status != RejectReason::None){
+            Reject(orderId, status);
+            return;
+        }
+
+        Order& order = pool_[handle];
+        if (quantity <= order.getFilled()){
+            CancelOrder(origOrderId);
+            return;
+        }
+        uint32 leaves = quantity - order.getFilled();
+        status = CheckRisk(order.getSession(), order.getSide(), price, quantity, leaves > order.getRemaining() ? leaves - order.getRemaining() : 0,
+                           !order.isStop() && price != order.getPrice());
+        if (status != RejectReason::None){
+            Reject(orderId, status);
+            return;
+        }
+        if (!order.isStop() && price != order.getPrice() && !ensureLevel(price)){
+            Reject(orderId, RejectReason::PriceOutOfRange);
+            return;
+        }
+        if (orderId != origOrderId){
+            orders_.erase(origOrderId);
+            orders_.insert(orderId, handle);
+        }
+        if (order.isStop()){
+            accountOpen_[order.getSession()] += leaves;
+            accountOpen_[order.getSession()] -= order.getRemaining();
+            order.amend(orderId, price, quantity);
+            Report(ExecType::Replace, order, price, quantity);
+            return;
+        }
+
+        if (price == order.getPrice() && leaves <= order.getRemaining()){
+            openQuantity(order.getSide(), levelIndex(price)) -= order.getRemaining() - leaves;
+            accountOpen_[order.getSession()] -= order.getRemaining() - leaves;
+            order.amend(orderId, price, quantity);
+            Report(ExecType::Replace, order, price, quantity);
+            CollectDepth();
+            return;
+        }
+
+        if (order.getSide() == Side::Buy){
+            Unrest<Side::Buy>(handle);
+        }else {
+            Unrest<Side::Sell>(handle);
+        }
+        order.amend(orderId, price, quantity);
+        Report(ExecType::Replace, order, price, quantity);
+        if (order.getSide() == Side::Buy){
+            Place<Side::Buy>(handle);
+        }else {
+            Place<Side::Sell>(handle);
+        }
+        CollectDepth();
+        ReleaseStops();
+    }
+
+    // Copies volume and open size for every tick from highPrice down to lowPrice, clamped to
+    // the ladder, into dense arrays. Cheap enough to take on the matching thread and render
+    // elsewhere.
+    void SnapshotDom(Tick highPrice, Tick lowPrice, DomSnapshot& dom) const {
+        highPrice = std::min(highPrice, anchor_ + static_cast<Tick>(ladderSize) - 1);
+        lowPrice = std::max(lowPrice, anchor_);
+        size_t rows = highPrice >= lowPrice ? static_cast<size_t>(highPrice - lowPrice + 1) : 0;
+        dom.highPrice = highPrice;
+        dom.lowPrice = lowPrice;
+        dom.midPrice = hasBids() && hasAsks() ? bestBid() + (bestAsk() - bestBid()) / 2 : highPrice + 1;
+        dom.volume.resize(rows);
+        dom.bids.resize(rows);
+        dom.asks.resize(rows);
+        for(size_t row = 0; row < rows; row++){
+            const LevelStat& stat = levelStats_[levelIndex(highPrice - static_cast<Tick>(row))];
+            dom.volume[row] = stat.volume;
+            dom.bids[row] = stat.openBids;
+            dom.asks[row] = stat.openAsks;
+        }
+    }
+
+    void PrintDom(){
+        if(bidLevels_.empty() || askLevels_.empty()){
+            std::cout << "Not enough orders to print a DOM" << std::endl;
+            return;
+        }
+        SnapshotDom(anchor_ + static_cast<Tick>(askLevels_.highest()), anchor_ + static_cast<Tick>(bidLevels_.lowest()), dom_);
+        domRenderer_.Render(dom_, contract_);
+        std::cout.flush();
+        domRenderer_.Write();
+    }
+
+    // Snapshot layout, little-endian:
+    // header   magic[8] | journalSeq u64 | depthSeq u64 | anchor i32 | anchored u8 | traded u8 | pad u16
+    //          | orders u32 | volumes u32 | stops u32 | lastTrade i32 | sessions u32 | pad u32
+    // orders   orderId u32 | price i32 | quantity u32 | remaining u32 | orderType u8 | side u8 | pad u16 | session u32,
+    //          in queue order per level
+    // volumes  price i32 | volume u32, for every level that has traded
+    // stops    orderId u32 | price i32 | stopPrice i32 | quantity u32 | orderType u8 | side u8 | stopType u8 | pad u8 | session u32,
+    //          in trigger order per level
+    // sessions name char[16], in id order from 1
+    // trailer  FNV-1a of everything before it, u64
+    static constexpr char snapshotMagic[8] = {'O', 'B', 'S', 'N', 'A', 'P', '0', '4'};
+    static constexpr size_t snapshotHeaderSize = 56;
+    static constexpr size_t snapshotOrderSize = 24;
+    static constexpr size_t snapshotVolumeSize = 8;
+    static constexpr size_t snapshotStopSize = 24;
+    static constexpr size_t snapshotSessionSize = sizeof(Symbol::name);
+
+    // Writes the resting book to a temporary file, syncs it and renames it over path, so a
+    // crash leaves either the previous snapshot or the new one. journalSeq is the last
+    // journal record the snapshot includes.
+    bool SaveSnapshot(const char* path, uint64 journalSeq) const {
+        std::vector<unsigned char> out(snapshotHeaderSize);
+        uint32 orderCount = 0;
+        uint32 volumeCount = 0;
+        auto saveLevels = [&](const LevelBitmap& levels, const std::vector<OrderQueue>& queues){
+            if(levels.empty()){
+                return;
+            }
+            for(uint32 lvl = levels.lowest(); lvl != ladderSize; lvl = levels.above(lvl)){
+                for(OrderHandle handle = queues[lvl].head; handle != nullHandle; handle = pool_.next(handle)){
+                    const Order& order = pool_[handle];
+                    unsigned char* record = &*out.insert(out.end(), snapshotOrderSize, 0);
+                    putLE(record, order.getOrderId(), 4);
+                    putLE(record + 4, static_cast<uint32>(order.getPrice()), 4);
+                    putLE(record + 8, order.getQuantity(), 4);
+                    putLE(record + 12, order.getRemaining(), 4);
+                    record[16] = static_cast<unsigned char>(order.getOrderType());
+                    record[17] = order.getSide() == Side::Buy ? 0 : 1;
+                    putLE(record + 20, order.getSession(), 4);
+                    orderCount++;
+                }
+            }
+        };
+        saveLevels(bidLevels_, bids_);
+        saveLevels(askLevels_, asks_);
+        for(uint32 lvl = 0; lvl < ladderSize; lvl++){
+            if(levelStats_[lvl].volume != 0){
+                unsigned char* record = &*out.insert(out.end(), snapshotVolumeSize, 0);
+                putLE(record, static_cast<uint32>(anchor_ + static_cast<Tick>(lvl)), 4);
+                putLE(record + 4, levelStats_[lvl].volume, 4);
+                volumeCount++;
+            }
+        }
+        for(const std::vector<OrderQueue>* stops : {&buyStops_, &sellStops_}){
+            for(uint32 lvl = 0; lvl < ladderSize; lvl++){
+                for(OrderHandle handle = (*stops)[lvl].head; handle != nullHandle; handle = pool_.next(handle)){
+                    const Order& order = pool_[handle];
+                    unsigned char* record = &*out.insert(out.end(), snapshotStopSize, 0);
+                    putLE(record, order.getOrderId(), 4);
+                    putLE(record + 4, static_cast<uint32>(order.getPrice()), 4);
+                    putLE(record + 8, static_cast<uint32>(order.getStopPrice()), 4);
+                    putLE(record + 12, order.getQuantity(), 4);
+                    record[16] = static_cast<unsigned char>(order.getOrderType());
+                    record[17] = order.getSide() == Side::Buy ? 0 : 1;
+                    record[18] = static_cast<unsigned char>(order.getStopType());
+                    putLE(record + 20, order.getSession(), 4);
+                }
+            }
+        }
+        for(uint32 session = 1; session <= sessions_.size(); session++){
+            const Symbol& name = sessions_.name(session);
+            out.insert(out.end(), name.name, name.name + snapshotSessionSize);
+        }
+
+        unsigned char* header = out.data();
+        std::copy(snapshotMagic, snapshotMagic + 8, header);
+        putLE(header + 8, journalSeq, 8);
+        putLE(header + 16, depthSequence_, 8);
+        putLE(header + 24, static_cast<uint32>(anchor_), 4);
+        header[28] = anchored_ ? 1 : 0;
+        header[29] = traded_ ? 1 : 0;
+        putLE(header + 32, orderCount, 4);
+        putLE(header + 36, volumeCount, 4);
+        putLE(header + 40, stopCount_, 4);
+        putLE(header + 44, static_cast<uint32>(lastTrade_), 4);
+        putLE(header + 48, sessions_.size(), 4);
+        uint64 checksum = fnv1a(out.data(), out.size());
+        putLE(&*out.insert(out.end(), 8, 0), checksum, 8);
+
+        std::string temp = std::string(path) + ".tmp";
+        int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0){
+            return false;
+        }
+        size_t written = 0;
+        while(written < out.size()){
+            ssize_t n = ::write(fd, out.data() + written, out.size() - written);
+            if(n < 0 && errno == EINTR){
+                continue;
+            }
+            if(n <= 0){
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+        bool ok = written == out.size() && ::fsync(fd) == 0;
+        ::close(fd);
+        if(!ok || std::rename(temp.c_str(), path) != 0){
+            return false;
+        }
+        // The rename only survives a crash once the directory entry itself is on disk.
+        std::string_view file(path);
+        size_t slash = file.rfind('/');
+        std::string dir = slash == std::string_view::npos ? std::string(".") : std::string(file.substr(0, std::max<size_t>(slash, 1)));
+        int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if(dirFd < 0){
+            return false;
+        }
+        ok = ::fsync(dirFd) == 0;
+        ::close(dirFd);
+        return ok;
+    }
+
+    // Rebuilds an empty book from a snapshot and sets journalSeq to the last journal record it
+    // covers. Fails if the file is missing or corrupt or the book already holds orders.
+    // Restored levels count as published, so depth consumers should start from GetBookLevels().
+    bool LoadSnapshot(const char* path, uint64& journalSeq){
+        MappedFile file(path);
+        const unsigned char* data = file.data();
+        if(file.size() < snapshotHeaderSize + 8 || pool_.size() != 0 || sessions_.size() != 0 || !std::equal(snapshotMagic, snapshotMagic + 8, data)){
+            return false;
+        }
+        uint32 orderCount = static_cast<uint32>(getLE(data + 32, 4));
+        uint32 volumeCount = static_cast<uint32>(getLE(data + 36, 4));
+        uint32 stopCount = static_cast<uint32>(getLE(data + 40, 4));
+        uint32 sessionCount = static_cast<uint32>(getLE(data + 48, 4));
+        size_t size = snapshotHeaderSize + size_t(orderCount) * snapshotOrderSize + size_t(volumeCount) * snapshotVolumeSize
+            + size_t(stopCount) * snapshotStopSize + size_t(sessionCount) * snapshotSessionSize;
+        if(file.size() != size + 8 || getLE(data + size, 8) != fnv1a(data, size) || uint64(orderCount) + stopCount > pool_.capacity()){
+            return false;
+        }
+
+        anchor_ = static_cast<Tick>(static_cast<uint32>(getLE(data + 24, 4)));
+        anchored_ = data[28] != 0;
+        traded_ = data[29] != 0;
+        lastTrade_ = static_cast<Tick>(static_cast<uint32>(getLE(data + 44, 4)));
+        depthSequence_ = getLE(data + 16, 8);
+        const unsigned char* record = data + snapshotHeaderSize;
+        for(uint32 i = 0; i < orderCount; i++, record += snapshotOrderSize){
+            Side side = record[17] == 0 ? Side::Buy : Side::Sell;
+            Order order = Order::fromTicks(static_cast<OrderType>(record[16]), side, static_cast<uint32>(getLE(record, 4)),
+                static_cast<Tick>(static_cast<uint32>(getLE(record + 4, 4))), static_cast<uint32>(getLE(record + 8, 4)));
+            order.fillOrder(order.getQuantity() - static_cast<uint32>(getLE(record + 12, 4)));
+            order.setSession(static_cast<uint32>(getLE(record + 20, 4)));
+            OrderHandle handle = pool_.allocate(order);
+            orders_.insert(order.getOrderId(), handle);
+            accountOpen_[order.getSession()] += order.getRemaining();
+            uint32 lvl = levelIndex(order.getPrice());
+            LevelStat& stat = levelStats_[lvl];
+            if(side == Side::Buy){
+                pool_.pushBack(bids_[lvl], handle);
+                bidLevels_.set(lvl);
+                stat.publishedBids = stat.openBids += order.getRemaining();
+            }else{
+                pool_.pushBack(asks_[lvl], handle);
+                askLevels_.set(lvl);
+                stat.publishedAsks = stat.openAsks += order.getRemaining();
+            }
+        }
+        for(uint32 i = 0; i < volumeCount; i++, record += snapshotVolumeSize){
+            Tick price = static_cast<Tick>(static_cast<uint32>(getLE(record, 4)));
+            if(inLadder(price)){
+                levelStats_[levelIndex(price)].volume = static_cast<uint32>(getLE(record + 4, 4));
+            }
+        }
+        for(uint32 i = 0; i < stopCount; i++, record += snapshotStopSize){
+            Side side = record[17] == 0 ? Side::Buy : Side::Sell;
+            Order order = Order::fromTicks(static_cast<OrderType>(record[16]), side, static_cast<uint32>(getLE(record, 4)),
+                static_cast<Tick>(static_cast<uint32>(getLE(record + 4, 4))), static_cast<uint32>(getLE(record + 12, 4)));
+            order.setStop(static_cast<StopType>(record[18]), static_cast<Tick>(static_cast<uint32>(getLE(record + 8, 4))));
+            order.setSession(static_cast<uint32>(getLE(record + 20, 4)));
+            OrderHandle handle = pool_.allocate(order);
+            orders_.insert(order.getOrderId(), handle);
+            if(side == Side::Buy){
+                Arm<Side::Buy>(handle);
+            }else{
+                Arm<Side::Sell>(handle);
+            }
+        }
+        for(uint32 i = 0; i < sessionCount; i++, record += snapshotSessionSize){
+            Symbol name;
+            std::memcpy(name.name, record, Symbol::maxLength);
+            sessions_.intern(name);
+        }
+        journalSeq = getLE(data + 8, 8);
+        return true;
+    }
+
+    // Commands executed while a journal is attached are logged before they touch the book.
+    // Once the journal fails every command is rejected instead, so nothing is acked that
+    // recovery could not rebuild.
+    void AttachJournal(Journal* journal){
+        journal_ = journal;
+    }
+
+    void Execute(const OrderCommand& command){
+        if(journal_ != nullptr && journal_ -> append(command) == 0){
+            Reject(command.orderId, RejectReason::JournalFailed);
+            return;
+        }
+        switch(command.type){
+        case CommandType::New:{
+            Order order = Order::fromTicks(command.orderType, command.side, command.orderId, command.price, command.quantity);
+            order.setStop(command.stopType, command.stopPrice);
+            order.setSession(sessions_.intern(command.session));
+            AddOrder(order);
+            break;
+        }
+        case CommandType::Cancel:
+            CancelOrder(command.orderId);
+            break;
+        case CommandType::Replace:
+            ModifyOrder(command.origOrderId, command.orderId, command.price, command.quantity);
+            break;
+        case CommandType::MassCancel:
+            MassCancel(command.orderId, command.scope, sessions_.intern(command.session));
+            break;
+        }
+    }
+
+    void ParseMessage(std::string_view msg){
+        OrderCommand command;
+        RejectReason status;
+        {
+            auto span = stats_.time(Stage::Parse);
+            status = DecodeFix(msg, command, contract_);
+        }
+        if(status != RejectReason::None){
+            Reject(command.orderId, status);
+            return;
+        }
+        Execute(command);
+    }
+
+    void ParseBinary(const unsigned char* data, size_t size){
+        OrderCommand command;
+        RejectReason status;
+        {
+            auto span = stats_.time(Stage::Parse);
+            status = DecodeBinary(data, size, command);
+        }
+        if(status != RejectReason::None){
+            Reject(command.orderId, status);
+            return;
+        }
+        Execute(command);
+    }
+
+    void populateOrderBook(){
+        if(populated_){
+            std::cout << "Ourderbook has already been populated" << std::endl;
+            return;
+        }
+        struct Seed{
+            Side side;
+            uint32 orderId;
+            const char* price;
+            uint32 quantity;
+        };
+        static constexpr Seed seeds[] = {
+            {Side::Buy,  10000,  "98.00",  30},
+            {Side::Sell, 20000,  "98.00",  30},
+            {Side::Buy,  30000,  "98.25",  20},
+            {Side::Sell, 40000,  "98.25",  20},
+            {Side::Buy,  50000,  "98.50",  40},
+            {Side::Sell, 60000,  "98.50",  40},
+            {Side::Buy,  70000,  "98.75",  35},
+            {Side::Sell, 80000,  "98.75",  35},
+            {Side::Buy,  90000,  "99.00",  50},
+            {Side::Sell, 100000, "99.00",  50},
+            {Side::Buy,  110000, "99.25",  25},
+            {Side::Sell, 120000, "99.25",  25},
+            {Side::Buy,  130000, "99.50",  45},
+            {Side::Sell, 140000, "99.50",  45},
+            {Side::Buy,  150000, "99.75",  55},
+            {Side::Sell, 160000, "99.75",  55},
+            {Side::Buy,  170000, "100.00", 60},
+            {Side::Sell, 180000, "100.00", 60},
+            {Side::Buy,  190000, "100.25", 50},
+            {Side::Sell, 200000, "100.25", 50},
+            {Side::Buy,  210000, "100.50", 40},
+            {Side::Sell, 220000, "100.50", 40},
+            {Side::Buy,  203000, "100.75", 35},
+            {Side::Sell, 240000, "100.75", 35},
+            {Side::Buy,  250000, "101.00", 30},
+            {Side::Sell, 260000, "101.00", 30},
+            {Side::Buy,  270000, "101.25", 25},
+            {Side::Sell, 280000, "101.25", 25},
+            {Side::Buy,  290000, "101.50", 20},
+            {Side::Sell, 300000, "101.50", 20},
+            {Side::Buy,  310000, "101.75", 15},
+            {Side::Sell, 320000, "101.75", 15},
+            {Side::Buy,  330000, "102.00", 10},
+            {Side::Sell, 340000, "102.00", 10},
+            {Side::Buy,  350000, "102.25", 5},
+            {Side::Buy,  10001,  "99",     50},
+            {Side::Buy,  20001,  "99.25",  40},
+            {Side::Buy,  30001,  "99.50",  60},
+            {Side::Buy,  40001,  "99.75",  70},
+            {Side::Buy,  50001,  "100.00", 10},
+            {Side::Buy,  60001,  "100.00", 5},
+            {Side::Buy,  70001,  "100.25", 30},
+            {Side::Buy,  80001,  "100.50", 20},
+            {Side::Buy,  90001,  "100.75", 10},
+            {Side::Sell, 100001, "100.50", 80},
+            {Side::Sell, 110001, "100.25", 90},
+            {Side::Sell, 120001, "100.00", 80},
+            {Side::Sell, 130001, "100.75", 10},
+            {Side::Sell, 140001, "101.00", 50},
+            {Side::Sell, 150001, "101.25", 40},
+            {Side::Sell, 160001, "101.50", 60},
+            {Side::Sell, 170001, "101.75", 70},
+            {Side::Sell, 180001, "102.00", 80},
+            {Side::Buy,  190001, "98.75",  20},
+            {Side::Buy,  200001, "98.50",  30},
+            {Side::Buy,  210001, "98.25",  40},
+            {Side::Buy,  220001, "98.00",  50},
+            {Side::Sell, 230001, "102.25", 40},
+            {Side::Sell, 240001, "102.50", 30},
+            {Side::Sell, 250001, "102.75", 20},
+            {Side::Sell, 260001, "103.00", 10},
+            {Side::Buy,  270001, "99.00",  35},
+            {Side::Sell, 280001, "101.75", 25},
+            {Side::Buy,  290001, "99.50",  45},
+            {Side::Sell, 300001, "100.75", 15},
+            {Side::Buy,  330001, "99.75",  25},
+            {Side::Sell, 340001, "99.75",  25},
+            {Side::Buy,  350001, "99.25",  30}
+        };
+        for(const Seed& seed : seeds){
+            Tick price = 0;
+            if(!contract_.parseTicks(seed.price, price)){
+                std::cout << "Seed price " << seed.price << " is not on a tick" << std::endl;
+                continue;
+            }
+            AddOrder(Order::fromTicks(OrderType::GoodTillFill, seed.side, seed.orderId, price, seed.quantity));
+        }
+        populated_ = true;
+    }
+};
+
+// Depth deltas as fixed 24-byte little-endian records:
+// sequence u64 | price i32 (ticks) | quantity u32 | side u8 (0 buy, 1 sell) | action u8 (0 add, 1 update, 2 delete) | 6 bytes padding
+constexpr size_t depthRecordSize = 24;
+
+inline void EncodeDepth(const DepthUpdate& update, unsigned char* out){
+    putLE(out, update.sequence, 8);
+    putLE(out + 8, static_cast<uint32>(update.price), 4);
+    putLE(out + 12, update.quantity, 4);
+    putLE(out + 16, update.side == Side::Buy ? 0 : 1, 1);
+    putLE(out + 17, static_cast<uint64>(update.action), 1);
+    putLE(out + 18, 0, 6);
+}
+
+class DepthFileWriter{
+private:
+    std::ofstream file_;
+    std::vector<unsigned char> buffer_;
+    size_t used_ = 0;
+
+public:
+    explicit DepthFileWriter(const char* path):
+        file_ (path, std::ios::binary | std::ios::trunc),
+        buffer_ (depthRecordSize * 4096)
+        {}
+
+        ~DepthFileWriter(){
+            flush();
+        }
+
+        bool isOpen() const { return file_.is_open(); }
+
+        void write(const DepthUpdate& update){
+            if(used_ == buffer_.size()){
+                flush();
+            }
+            EncodeDepth(update, buffer_.data() + used_);
+            used_ += depthRecordSize;
+        }
+
+        void flush(){
+            file_.write(reinterpret_cast<const char*>(buffer_.data()), static_cast<std::streamsize>(used_));
+            file_.flush();
+            used_ = 0;
+        }
+};
+
+struct SymbolReport{
+    uint32 symbolId;
+    ExecutionReport report;
+};
+
+// Routes commands to one Orderbook per symbol. Symbols are assigned round robin to a fixed
+// set of worker threads when first seen and never move, and each worker has its own SPSC
+// inbox from the submitting thread, so per-symbol order is preserved while unrelated
+// symbols match in parallel. Submit, Poll and Flush must all be called from one thread.
+class MatchingEngine{
+public:
+    using ReportHandler = std::function<void(const SymbolReport&)>;
+    static constexpr uint32 unknownSymbol = nullHandle;
+
+private:
+    struct ShardCommand{
+        uint32 book;
+        uint32 symbolId;
+        OrderCommand command;
+    };
+
+    struct Shard{
+        SpscQueue<ShardCommand> inbox;
+        SpscQueue<SymbolReport> outbox;
+        std::vector<std::unique_ptr<Orderbook>> books;
+        alignas(cacheLine) std::atomic<uint64> processed{0};
+        uint64 submitted = 0;
+        uint32 bookCount = 0;
+        IdleStrategy idle;
+        IdleStrategy full;
+        std::thread worker;
+
+        Shard(uint32 queueCapacity, WaitPolicy wait):
+            inbox (queueCapacity),
+            outbox (queueCapacity),
+            idle (wait),
+            full (wait)
+            {}
+    };
+
+    struct SymbolRoute{
+        uint32 shard;
+        uint32 book;
+        const ContractSpec* contract;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::unordered_map<std::string, uint32> symbolIds_;
+    std::vector<SymbolRoute> routes_;
+    std::vector<std::string> symbolNames_;
+    ReportHandler handler_;
+    ContractTable contracts_;
+    RiskLimits risk_;
+    uint32 orderCapacity_;
+    WaitPolicy wait_;
+    std::atomic<bool> running_{true};
+
+    static void Publish(Shard& shard, uint32 symbolId, const ExecutionReport& report){
+        SymbolReport out{symbolId, report};
+        while(!shard.outbox.tryPush(out)){
+            shard.full.idle();
+        }
+        shard.full.reset();
+    }
+
+    void Work(Shard& shard){
+        ShardCommand item;
+        while(true){
+            if(!shard.inbox.tryPop(item)){
+                if(!running_.load(std::memory_order_acquire) && shard.inbox.empty()){
+                    return;
+                }
+                shard.idle.idle();
+                continue;
+            }
+            shard.idle.reset();
+            if(item.book == shard.books.size()){
+                const ContractSpec& contract = contracts_.find(item.command.symbol);
+                shard.books.push_back(std::make_unique<Orderbook>(contract.bookCapacity(orderCapacity_)));
+                shard.books.back() -> setContract(contract);
+                shard.books.back() -> setRiskLimits(risk_);
+                shard.books.back() -> setReportSink([&shard, symbolId = item.symbolId](const ExecutionReport& report){
+                    Publish(shard, symbolId, report);
+                });
+                shard.books.back() -> setDepthSink([](const DepthUpdate&){});
+            }
+            Orderbook& book = *shard.books[item.book];
+            book.Execute(item.command);
+            book.DrainReports([&](const ExecutionReport& report){
+                Publish(shard, item.symbolId, report);
+            });
+            book.DrainDepth([](const DepthUpdate&){});
+            shard.processed.fetch_add(1, std::memory_order_release);
+        }
+    }
+
+    uint32 Route(const Symbol& symbol){
+        auto it = symbolIds_.find(std::string(symbol.view()));
+        if(it != symbolIds_.end()){
+            return it -> second;
+        }
+        uint32 symbolId = static_cast<uint32>(routes_.size());
+        uint32 shard = symbolId % shards_.size();
+        routes_.push_back(SymbolRoute{shard, shards_[shard] -> bookCount++, &contracts_.find(symbol)});
+        symbolNames_.emplace_back(symbol.view());
+        symbolIds_.emplace(symbolNames_.back(), symbolId);
+        return symbolId;
+    }
+
+public:
+    // orderCapacity sizes every book whose contract does not set its own.
+    MatchingEngine(uint32 shardCount, ReportHandler handler, const ContractTable& contracts = ContractTable{}, const RiskLimits& risk = RiskLimits{},
+                   uint32 orderCapacity = Orderbook::defaultOrderCapacity, uint32 queueCapacity = 1 << 16, WaitPolicy wait = WaitPolicy::Backoff):
+        handler_ (std::move(handler)),
+        contracts_ (contracts),
+        risk_ (risk),
+        orderCapacity_ (orderCapacity),
+        wait_ (wait)
+        {
+            for(uint32 i = 0; i < std::max<uint32>(1, shardCount); i++){
+                shards_.push_back(std::make_unique<Shard>(queueCapacity, wait));
+            }
+            for(auto& shard : shards_){
+                shard -> worker = std::thread([this, s = shard.get()]{ Work(*s); });
+            }
+        }
+
+        ~MatchingEngine(){
+            Stop();
+        }
+
+        void Stop(){
+            if(!running_.load()){
+                return;
+            }
+            Flush();
+            running_.store(false, std::memory_order_release);
+            for(auto& shard : shards_){
+                shard -> worker.join();
+            }
+        }
+
+        void Submit(const OrderCommand& command){
+            if(command.symbol.empty()){
+                handler_(SymbolReport{unknownSymbol, ExecutionReport{ExecType::Reject, RejectReason::InvalidSymbol, command.side, command.orderId, 0, 0, 0, OrderType::GoodTillFill, StopType::None}});
+                return;
+            }
+            uint32 symbolId = Route(command.symbol);
+            const SymbolRoute& route = routes_[symbolId];
+            Shard& shard = *shards_[route.shard];
+            ShardCommand item{route.book, symbolId, command};
+            IdleStrategy full(wait_);
+            while(!shard.inbox.tryPush(item)){
+                Poll();
+                full.idle();
+            }
+            shard.submitted++;
+        }
+
+        void Submit(std::string_view msg){
+            OrderCommand command;
+            Submit(command, DecodeFix(msg, command, contracts_));
+        }
+
+        void Submit(const unsigned char* data, size_t size){
+            OrderCommand command;
+            Submit(command, DecodeBinary(data, size, command));
+        }
+
+        void Submit(const OrderCommand& command, RejectReason status){
+            if(status != RejectReason::None){
+                handler_(SymbolReport{unknownSymbol, ExecutionReport{ExecType::Reject, status, Side::Buy, command.orderId, 0, 0, 0, OrderType::GoodTillFill, StopType::None}});
+                return;
+            }
+            Submit(command);
+        }
+
+        void Poll(){
+            SymbolReport report;
+            for(auto& shard : shards_){
+                while(shard -> outbox.tryPop(report)){
+                    handler_(report);
+                }
+            }
+        }
+
+        // Blocks until every submitted command has been matched and its reports handled.
+        void Flush(){
+            IdleStrategy idle(wait_);
+            for(auto& shard : shards_){
+                while(shard -> processed.load(std::memory_order_acquire) != shard -> submitted){
+                    Poll();
+                    idle.idle();
+                }
+                idle.reset();
+            }
+            Poll();
+        }
+
+        uint32 getShardCount() const { return static_cast<uint32>(shards_.size()); }
+        uint32 getSymbolCount() const { return static_cast<uint32>(routes_.size()); }
+        const std::string& getSymbolName(uint32 symbolId) const { return symbolNames_[symbolId]; }
+
+        // Contract of a symbol, or the fallback for unknownSymbol.
+        const ContractSpec& getContract(uint32 symbolId) const {
+            return symbolId < routes_.size() ? *routes_[symbolId].contract : contracts_.find(Symbol{});
+        }
+
+        // Only safe once Flush() or Stop() has returned.
+        Orderbook& getBook(uint32 symbolId){
+            const SymbolRoute& route = routes_[symbolId];
+            return *shards_[route.shard] -> books[route.book];
+        }
+
+        // Stats of every book merged; the same rule as getBook() applies.
+        EngineStats CollectStats(){
+            EngineStats stats;
+            for(uint32 i = 0; i < getSymbolCount(); i++){
+                stats.merge(getBook(i).getStats());
+            }
+            return stats;
+        }
+};
+
+struct GatewayOptions{
+    WaitPolicy wait = WaitPolicy::Backoff;
+    int32 matchCore = -1;
+    int32 outputCore = -1;
+    uint32 batchSize = 64;
+    uint32 queueCapacity = 1 << 16;
+    uint32 orderCapacity = Orderbook::defaultOrderCapacity;
+    ContractSpec contract;
+    RiskLimits risk;
+};
+
+// Pipelined runtime around a single book. The thread calling Submit decodes messages into
+// fixed-size commands and pushes them onto an SPSC ring; a matching thread owns the book and
+// executes them in batches, pushing the reports of each batch onto a second ring; an output
+// thread hands those to the report handler. A slow handler only backs up the output ring.
+// Submit, Flush, Stop and WithBook must all be called from one thread.
+class Gateway{
+public:
+    using ReportHandler = std::function<void(const ExecutionReport&)>;
+
+private:
+    struct GatewayCommand{
+        OrderCommand command;
+        RejectReason status;
+    };
+
+    Orderbook book_;
+    SpscQueue<GatewayCommand> inbox_;
+    SpscQueue<ExecutionReport> outbox_;
+    ReportHandler handler_;
+    GatewayOptions options_;
+    IdleStrategy full_;
+    uint64 submitted_ = 0;
+    uint64 forwarded_ = 0;
+    alignas(cacheLine) std::atomic<uint64> matched_{0};
+    alignas(cacheLine) std::atomic<uint64> produced_{0};
+    alignas(cacheLine) std::atomic<uint64> consumed_{0};
+    std::atomic<bool> running_{true};
+    std::thread matcher_;
+    std::thread output_;
+
+    // Matcher thread only, or the caller once the matcher is idle.
+    void Forward(const ExecutionReport& report){
+        while(!outbox_.tryPush(report)){
+            full_.idle();
+        }
+        full_.reset();
+        forwarded_++;
+    }
+
+    void Match(){
+        PinThread(options_.matchCore);
+        IdleStrategy idle(options_.wait);
+        GatewayCommand item;
+        auto forward = [this](const ExecutionReport& report){ Forward(report); };
+        while(true){
+            uint32 batch = 0;
+            while(batch < options_.batchSize && inbox_.tryPop(item)){
+                if(item.status == RejectReason::None){
+                    book_.Execute(item.command);
+                }else{
+                    forward(ExecutionReport{ExecType::Reject, item.status, Side::Buy, item.command.orderId, 0, 0, 0, OrderType::GoodTillFill, StopType::None});
+                }
+                batch++;
+            }
+            if(batch == 0){
+                if(!running_.load(std::memory_order_acquire) && inbox_.empty()){
+                    return;
+                }
+                idle.idle();
+                continue;
+            }
+            idle.reset();
+            book_.DrainReports(forward);
+            book_.DrainDepth([](const DepthUpdate&){});
+            produced_.store(forwarded_, std::memory_order_release);
+            matched_.fetch_add(batch, std::memory_order_release);
+        }
+    }
+
+    void Output(){
+        PinThread(options_.outputCore);
+        IdleStrategy idle(options_.wait);
+        ExecutionReport report;
+        uint64 consumed = 0;
+        while(true){
+            if(!outbox_.tryPop(report)){
+                if(!running_.load(std::memory_order_acquire) && outbox_.empty()
+                   && consumed == produced_.load(std::memory_order_acquire)){
+                    return;
+                }
+                idle.idle();
+                continue;
+            }
+            idle.reset();
+            handler_(report);
+            consumed_.store(++consumed, std::memory_order_release);
+        }
+    }
+
+public:
+    explicit Gateway(ReportHandler handler, const GatewayOptions& options = GatewayOptions{}):
+        book_ (options.contract.bookCapacity(options.orderCapacity)),
+        inbox_ (options.queueCapacity),
+        outbox_ (options.queueCapacity),
+        handler_ (std::move(handler)),
+        options_ (options),
+        full_ (options.wait)
+        {
+            book_.setContract(options.contract);
+            book_.setRiskLimits(options.risk);
+            book_.setReportSink([this](const ExecutionReport& report){ Forward(report); });
+            book_.setDepthSink([](const DepthUpdate&){});
+            matcher_ = std::thread([this]{ Match(); });
+            output_ = std::thread([this]{ Output(); });
+        }
+
+        ~Gateway(){
+            Stop();
+        }
+
+        void Stop(){
+            if(!running_.load()){
+                return;
+            }
+            Flush();
+            running_.store(false, std::memory_order_release);
+            matcher_.join();
+            output_.join();
+        }
+
+        void Submit(const OrderCommand& command, RejectReason status = RejectReason::None){
+            IdleStrategy idle(options_.wait);
+            GatewayCommand item{command, status};
+            while(!inbox_.tryPush(item)){
+                idle.idle();
+            }
+            submitted_++;
+        }
+
+        void Submit(std::string_view msg){
+            OrderCommand command;
+            RejectReason status = DecodeFix(msg, command, options_.contract);
+            Submit(command, status);
+        }
+
+        void Submit(const unsigned char* data, size_t size){
+            OrderCommand command;
+            RejectReason status = DecodeBinary(data, size, command);
+            Submit(command, status);
+        }
+
+        // Blocks until every submitted command has been matched and its reports handled.
+        void Flush(){
+            IdleStrategy idle(WaitPolicy::Backoff);
+            while(matched_.load(std::memory_order_acquire) != submitted_){
+                idle.idle();
+            }
+            uint64 produced = produced_.load(std::memory_order_acquire);
+            while(consumed_.load(std::memory_order_acquire) != produced){
+                idle.idle();
+            }
+        }
+
+        // Flushes, then runs access on the calling thread with the book to itself. Reports the
+        // access raises go straight to the handler, which is idle at that point.
+        template<typename BookAccess>
+        void WithBook(BookAccess&& access){
+            Flush();
+            Orderbook::ReportSink matcherSink = book_.setReportSink(handler_);
+            access(book_);
+            book_.DrainReports(handler_);
+            book_.DrainDepth([](const DepthUpdate&){});
+            book_.setReportSink(std::move(matcherSink));
+        }
+};
+
+// Streams a file through a large reusable buffer and calls onLine for every line, without
+// the trailing newline. Lines longer than the buffer are skipped.
+template<typename LineHandler>
+bool ForEachLine(const char* path, LineHandler&& onLine){
+    std::ifstream file(path, std::ios::binary);
+    if(!file){
+        return false;
+    }
+    std::vector<char> buffer(1 << 22);
+    size_t carry = 0;
+    while(file){
+        file.read(buffer.data() + carry, buffer.size() - carry);
+        size_t filled = carry + static_cast<size_t>(file.gcount());
+        if(filled == 0){
+            break;
+        }
+        size_t start = 0;
+        while(true){
+            const char* nl = static_cast<const char*>(std::memchr(buffer.data() + start, '\n', filled - start));
+            if(nl == nullptr){
+                break;
+            }
+            size_t end = nl - buffer.data();
+            onLine(std::string_view(buffer.data() + start, end - start));
+            start = end + 1;
+        }
+        if(!file){
+            if(start < filled){
+                onLine(std::string_view(buffer.data() + start, filled - start));
+            }
+            break;
+        }
+        carry = filled - start;
+        if(carry == buffer.size()){
+            carry = 0;
+        }
+        std::memmove(buffer.data(), buffer.data() + start, carry);
+    }
+    return true;
+}
+
+struct ReplayStats{
+    uint64 messages = 0;
+    uint64 skipped = 0;
+    uint64 acks = 0;
+    uint64 fills = 0;
+    uint64 kills = 0;
+    uint64 cancels = 0;
+    uint64 replaces = 0;
+    uint64 triggers = 0;
+    uint64 massCancels = 0;
+    uint64 selfTrades = 0;
+    uint64 rejects = 0;
+
+    void count(const ExecutionReport& report){
+        switch(report.type){
+        case ExecType::Ack: acks++; break;
+        case ExecType::Fill: fills++; break;
+        case ExecType::Kill: kills++; break;
+        case ExecType::Cancel: cancels++; break;
+        case ExecType::Replace: replaces++; break;
+        case ExecType::Trigger: triggers++; break;
+        case ExecType::MassCancel: massCancels++; break;
+        case ExecType::SelfTrade: selfTrades++; break;
+        case ExecType::Reject: rejects++; break;
+        }
+    }
+};
+
+void PrintBookSummary(Orderbook& orderbook){
+    const ContractSpec& contract = orderbook.getContract();
+    char price[32];
+    std::cout << "Resting orders: " << orderbook.getOrderCount();
+    if(orderbook.getStopCount() != 0){
+        std::cout << "  Pending stops: " << orderbook.getStopCount();
+    }
+    if(orderbook.hasBids()){
+        std::cout << "  Best bid: " << contract.format(orderbook.getBestBid(), price);
+    }
+    if(orderbook.hasAsks()){
+        std::cout << "  Best ask: " << contract.format(orderbook.getBestAsk(), price);
+    }
+    std::cout << "\n";
+    std::cout << "Dropped events: " << orderbook.getDroppedReports() << " reports, " << orderbook.getDroppedDepth() << " depth updates\n";
+    const TradeStore& trades = orderbook.getTrades();
+    TradeSummary summary = trades.summarise(TradeQuery{});
+    std::cout << "Trades: " << trades.size() << " (" << trades.getResident() << " in memory, " << trades.getSpilled()
+              << " spilled, " << trades.getDropped() << " dropped)  Volume: " << summary.volume << "  VWAP: " << summary.getVwap(contract.ticksPerPoint) << std::endl;
+    std::vector<PriceLevel> levels = trades.volumeByPrice(TradeQuery{});
+    size_t busiest = std::min<size_t>(3, levels.size());
+    if(busiest != 0){
+        std::partial_sort(levels.begin(), levels.begin() + busiest, levels.end(), [](const PriceLevel& a, const PriceLevel& b){
+            return a.quantity > b.quantity;
+        });
+        std::cout << "Busiest prices:";
+        for(size_t i = 0; i < busiest; i++){
+            std::cout << "  " << contract.format(levels[i].price, price) << " x " << levels[i].quantity;
+        }
+        std::cout << std::endl;
+    }
+}
+
+void PrintReplayStats(const ReplayStats& stats, double elapsed){
+    std::cout << "Replayed " << stats.messages << " messages in " << elapsed << " s ("
+              << static_cast<uint64>(elapsed > 0 ? stats.messages / elapsed : 0) << " msgs/sec), skipped " << stats.skipped << " lines\n";
+    std::cout << "Acks: " << stats.acks << "  Fills: " << stats.fills << " (" << stats.fills / 2 << " trades)"
+              << "  Kills: " << stats.kills << "  Cancels: " << stats.cancels << "  Replaces: " << stats.replaces << "  Triggers: " << stats.triggers << "  Mass cancels: " << stats.massCancels << "  Self-trades: " << stats.selfTrades << "  Rejects: " << stats.rejects << "\n";
+}
+
+bool IsFixLine(std::string_view line){
+    return line.size() >= 2 && line[0] == '8' && line[1] == '=';
+}
+
+// Replays either kind of log: FIX logs line by line, skipping lines that are not FIX, and
+// binary logs frame by frame.
+template<typename FixHandler, typename BinaryHandler>
+bool ForEachMessage(const char* path, uint64& skipped, FixHandler&& onFix, BinaryHandler&& onBinary){
+    if(IsBinaryLog(path)){
+        return ForEachFrame(path, onBinary);
+    }
+    return ForEachLine(path, [&](std::string_view line){
+        if(!IsFixLine(line)){
+            skipped++;
+            return;
+        }
+        onFix(line);
+    });
+}
+
+struct ReplayOptions{
+    bool printReports = false;
+    uint32 shards = 0;
+    uint32 orderCapacity = Orderbook::defaultOrderCapacity;
+    const char* depthPath = nullptr;
+    const char* tradesPath = nullptr;
+    const char* journalPath = nullptr;
+    const char* snapshotPath = nullptr;
+    uint32 snapshotEvery = 0;
+    const char* statsPath = nullptr;
+    uint32 statsEvery = 100000;
+    uint32 statsSample = EngineStats::defaultSampleEvery;
+    bool pipeline = false;
+    WaitPolicy wait = WaitPolicy::Backoff;
+    int32 ingestCore = -1;
+    int32 matchCore = -1;
+    int32 outputCore = -1;
+    ContractTable contracts;
+    RiskLimits risk;
+};
+
+// Appends one JSON line of engine stats to the --stats file, if there is one.
+void DumpStats(std::ofstream& statsFile, const EngineStats& engineStats, uint64 messages){
+    if(statsFile.is_open()){
+        engineStats.WriteJson(statsFile, messages);
+        statsFile.flush();
+    }
+}
+
+int RunShardedReplay(const char* path, const ReplayOptions& options){
+    ReplayStats stats;
+    std::ofstream statsFile;
+    if(options.statsPath != nullptr){
+        statsFile.open(options.statsPath, std::ios::app);
+    }
+    MatchingEngine engine(options.shards, [&](const SymbolReport& report){
+        stats.count(report.report);
+        if(options.printReports){
+            std::cout << '[' << report.symbolId << "] ";
+            PrintReport(report.report, std::cout, engine.getContract(report.symbolId));
+        }
+    }, options.contracts, options.risk, options.orderCapacity, 1 << 16, options.wait);
+
+    auto start = std::chrono::steady_clock::now();
+    bool opened = ForEachMessage(path, stats.skipped, [&](std::string_view line){
+        engine.Submit(line);
+        stats.messages++;
+    }, [&](const unsigned char* data, size_t size){
+        engine.Submit(data, size);
+        stats.messages++;
+    });
+    engine.Flush();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if(!opened){
+        std::cout << "Could not open " << path << std::endl;
+        return 1;
+    }
+
+    PrintReplayStats(stats, elapsed);
+    std::cout << engine.getSymbolCount() << " symbols on " << engine.getShardCount() << " worker threads\n";
+    for(uint32 i = 0; i < engine.getSymbolCount(); i++){
+        std::cout << '[' << i << "] " << engine.getSymbolName(i) << "  ";
+        PrintBookSummary(engine.getBook(i));
+    }
+    if(options.statsPath != nullptr){
+        EngineStats engineStats = engine.CollectStats();
+        engineStats.Print(std::cout);
+        DumpStats(statsFile, engineStats, stats.messages);
+    }
+    return 0;
+}
+
+// Replays through a Gateway: this thread reads and decodes, a matching thread owns the book
+// and an output thread counts and prints the reports.
+int RunPipelinedReplay(const char* path, const ReplayOptions& options){
+    PinThread(options.ingestCore);
+    ReplayStats stats;
+    GatewayOptions gatewayOptions;
+    gatewayOptions.wait = options.wait;
+    gatewayOptions.matchCore = options.matchCore;
+    gatewayOptions.outputCore = options.outputCore;
+    gatewayOptions.orderCapacity = options.orderCapacity;
+    gatewayOptions.contract = options.contracts.primary();
+    gatewayOptions.risk = options.risk;
+    Gateway gateway([&](const ExecutionReport& report){
+        stats.count(report);
+        if(options.printReports){
+            PrintReport(report, std::cout, gatewayOptions.contract);
+        }
+    }, gatewayOptions);
+
+    auto start = std::chrono::steady_clock::now();
+    uint64 skipped = 0;
+    uint64 messages = 0;
+    bool opened = ForEachMessage(path, skipped, [&](std::string_view line){
+        gateway.Submit(line);
+        messages++;
+    }, [&](const unsigned char* data, size_t size){
+        gateway.Submit(data, size);
+        messages++;
+    });
+    gateway.Flush();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if(!opened){
+        std::cout << "Could not open " << path << std::endl;
+        return 1;
+    }
+
+    stats.messages = messages;
+    stats.skipped = skipped;
+    PrintReplayStats(stats, elapsed);
+    gateway.WithBook([&](Orderbook& orderbook){
+        PrintBookSummary(orderbook);
+        if(options.statsPath != nullptr){
+            orderbook.getStats().Print(std::cout);
+        }
+        orderbook.PrintDom();
+    });
+    return 0;
+}
+
+// Restores the book from the latest snapshot plus every journal record after it, then
+// attaches the journal so the rest of the session is logged behind it.
+bool Recover(Orderbook& orderbook, Journal& journal, const ReplayOptions& recovery){
+    auto start = std::chrono::steady_clock::now();
+    uint64 snapshotSeq = 0;
+    bool restored = recovery.snapshotPath != nullptr && orderbook.LoadSnapshot(recovery.snapshotPath, snapshotSeq);
+    uint64 replayed = 0;
+    if(recovery.journalPath != nullptr){
+        Orderbook::ReportSink reportSink = orderbook.setReportSink([](const ExecutionReport&){});
+        Orderbook::DepthSink depthSink = orderbook.setDepthSink([](const DepthUpdate&){});
+        Journal::Replay(recovery.journalPath, snapshotSeq, [&](uint64, const OrderCommand& command){
+            orderbook.Execute(command);
+            replayed++;
+        });
+        orderbook.DrainReports([](const ExecutionReport&){});
+        orderbook.DrainDepth([](const DepthUpdate&){});
+        orderbook.setReportSink(std::move(reportSink));
+        orderbook.setDepthSink(std::move(depthSink));
+        if(!journal.open(recovery.journalPath)){
+            std::cout << "Could not open " << recovery.journalPath << std::endl;
+            return false;
+        }
+        orderbook.AttachJournal(&journal);
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if(restored || replayed > 0){
+        std::cout << "Recovered " << orderbook.getOrderCount() << " orders";
+        if(restored){
+            std::cout << " from snapshot at journal seq " << snapshotSeq;
+        }
+        std::cout << " + " << replayed << " journal records in " << elapsed * 1000.0 << " ms\n";
+    }
+    return true;
+}
+
+int RunReplay(const char* path, const ReplayOptions& options){
+    Orderbook orderbook(options.contracts.primary().bookCapacity(options.orderCapacity));
+    orderbook.setContract(options.contracts.primary());
+    orderbook.setRiskLimits(options.risk);
+    if(options.tradesPath != nullptr && !orderbook.SpillTrades(options.tradesPath)){
+        std::cout << "Could not open " << options.tradesPath << std::endl;
+        return 1;
+    }
+    orderbook.setStatsSampling(options.statsSample);
+    Journal journal;
+    if(!Recover(orderbook, journal, options)){
+        return 1;
+    }
+    auto snapshot = [&](){
+        if(!journal.commit()){
+            return;
+        }
+        if(!orderbook.SaveSnapshot(options.snapshotPath, journal.getSequence())){
+            std::cout << "Could not write " << options.snapshotPath << std::endl;
+        }
+    };
+    std::ofstream statsFile;
+    if(options.statsPath != nullptr){
+        statsFile.open(options.statsPath, std::ios::app);
+    }
+    ReplayStats stats;
+    std::unique_ptr<DepthFileWriter> depthFile;
+    uint64 depthUpdates = 0;
+    if(options.depthPath != nullptr){
+        depthFile = std::make_unique<DepthFileWriter>(options.depthPath);
+        if(!depthFile -> isOpen()){
+            std::cout << "Could not open " << options.depthPath << std::endl;
+            return 1;
+        }
+    }
+    auto consume = [&](const ExecutionReport& report){
+        stats.count(report);
+        if(options.printReports){
+            PrintReport(report, std::cout, orderbook.getContract());
+        }
+    };
+    auto writeDepth = [&](const DepthUpdate& update){
+        if(depthFile){
+            depthFile -> write(update);
+            depthUpdates++;
+        }
+    };
+    orderbook.setReportSink(consume);
+    orderbook.setDepthSink(writeDepth);
+
+    auto start = std::chrono::steady_clock::now();
+    auto applied = [&](){
+        stats.messages++;
+        orderbook.DrainReports(consume);
+        orderbook.DrainDepth(writeDepth);
+        if(options.snapshotPath != nullptr && options.snapshotEvery > 0 && stats.messages % options.snapshotEvery == 0){
+            snapshot();
+        }
+        if(options.statsPath != nullptr && options.statsEvery > 0 && stats.messages % options.statsEvery == 0){
+            DumpStats(statsFile, orderbook.getStats(), stats.messages);
+        }
+    };
+    bool opened = ForEachMessage(path, stats.skipped, [&](std::string_view line){
+        orderbook.ParseMessage(line);
+        applied();
+    }, [&](const unsigned char* data, size_t size){
+        orderbook.ParseBinary(data, size);
+        applied();
+    });
+    if(opened && options.snapshotPath != nullptr){
+        snapshot();
+    }
+    journal.close();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if(journal.failed()){
+        std::cout << "Journal write to " << options.journalPath << " failed: " << std::strerror(journal.getError()) << std::endl;
+    }
+
+    if(!opened){
+        std::cout << "Could not open " << path << std::endl;
+        return 1;
+    }
+
+    PrintReplayStats(stats, elapsed);
+    if(depthFile){
+        depthFile -> flush();
+        std::cout << "Wrote " << depthUpdates << " depth updates to " << options.depthPath << "\n";
+    }
+    PrintBookSummary(orderbook);
+    if(options.statsPath != nullptr){
+        EngineStats engineStats = orderbook.getStats();
+        engineStats.Print(std::cout);
+        DumpStats(statsFile, engineStats, stats.messages);
+    }
+    orderbook.PrintDom();
+    return journal.failed() ? 1 : 0;
+}
+
+// One what-if run of --simulate: the recorded flow replayed with a different price rule,
+// a coarser tick or part of the resting flow turned into IOC.
+struct SimulationConfig{
+    std::string name;
+    PriceRule priceRule = PriceRule::Resting;
+    uint32 tickMultiple = 1;
+    uint32 iocPercent = 0;
+
+    // Parses "price=aggressor,tick=2,ioc=25"; any key may be left out.
+    static bool parse(std::string_view spec, SimulationConfig& config){
+        config = SimulationConfig{};
+        config.name = spec.empty() ? "baseline" : std::string(spec);
+        while(!spec.empty()){
+            size_t comma = spec.find(',');
+            std::string_view item = spec.substr(0, comma);
+            spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+            size_t eq = item.find('=');
+            if(eq == std::string_view::npos){
+                return false;
+            }
+            std::string_view key = item.substr(0, eq);
+            std::string_view value = item.substr(eq + 1);
+            if(key == "price" && (value == "resting" || value == "aggressor")){
+                config.priceRule = value == "resting" ? PriceRule::Resting : PriceRule::Aggressor;
+            }else if(key == "tick"){
+                if(!parseUint(value, config.tickMultiple) || config.tickMultiple == 0){
+                    return false;
+                }
+            }else if(key == "ioc"){
+                if(!parseUint(value, config.iocPercent) || config.iocPercent > 100){
+                    return false;
+                }
+            }else{
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Buys round down and sells up onto the coarser grid, so no order becomes more aggressive.
+    Tick coarsen(Side side, Tick price) const {
+        Tick step = static_cast<Tick>(tickMultiple);
+        Tick floor = price / step * step;
+        if(floor > price){
+            floor -= step;
+        }
+        return side == Side::Buy || floor == price ? floor : floor + step;
+    }
+
+    // Which orders become IOC is picked by a hash of the order id, so every run that asks for
+    // the same percentage converts the same orders.
+    bool makesIoc(uint32 orderId) const {
+        return iocPercent > 0 && (orderId * 2654435761u >> 16) % 100 < iocPercent;
+    }
+
+    void apply(OrderCommand& command) const {
+        if(tickMultiple > 1){
+            if(command.type == CommandType::Replace || (command.type == CommandType::New && command.stopType != StopType::Stop)){
+                command.price = coarsen(command.side, command.price);
+            }
+            if(command.type == CommandType::New && command.stopType != StopType::None){
+                // A stop that rounds the wrong way would trigger earlier than recorded.
+                command.stopPrice = coarsen(command.side == Side::Buy ? Side::Sell : Side::Buy, command.stopPrice);
+                if(command.stopType == StopType::Stop){
+                    command.price = command.stopPrice;
+                }
+            }
+        }
+        if(command.type == CommandType::New && command.orderType == OrderType::GoodTillFill && makesIoc(command.orderId)){
+            command.orderType = OrderType::ImmediateOrCancel;
+        }
+    }
+};
+
+struct SimulationResult{
+    ReplayStats stats;
+    uint64 fillDigest = 14695981039346656037ull;
+    uint64 volume = 0;
+    int64 notional = 0;
+    uint32 resting = 0;
+    BookLevels levels{priceLevels{}, priceLevels{}};
+    double elapsed = 0;
+
+    // Folds every fill, in order, into one hash, so two runs compare by a single number.
+    void record(const ExecutionReport& report){
+        stats.count(report);
+        if(report.type != ExecType::Fill){
+            return;
+        }
+        for(uint64 field : {static_cast<uint64>(report.orderId), static_cast<uint64>(static_cast<uint32>(report.price)), static_cast<uint64>(report.quantity)}){
+            fillDigest = (fillDigest ^ field) * 1099511628211ull;
+        }
+        // Each trade reports a fill on both sides.
+        if(report.side == Side::Buy){
+            volume += report.quantity;
+            notional += static_cast<int64>(report.price) * report.quantity;
+        }
+    }
+
+    double getVwap(int32 perPoint) const { return volume == 0 ? 0.0 : static_cast<double>(notional) / volume / perPoint; }
+};
+
+// Price levels in the top of book that differ in price or size between two runs.
+uint32 CountDepthDifferences(const BookLevels& a, const BookLevels& b){
+    auto differ = [](const priceLevels& x, const priceLevels& y){
+        uint32 count = 0;
+        for(size_t i = 0; i < std::max(x.size(), y.size()); i++){
+            if(i >= x.size() || i >= y.size() || x[i].price != y[i].price || x[i].quantity != y[i].quantity){
+                count++;
+            }
+        }
+        return count;
+    };
+    return differ(a.getBids(), b.getBids()) + differ(a.getAsks(), b.getAsks());
+}
+
+// Decodes the log once into a shared, read-only command buffer, then replays it through a
+// private book per configuration on a pool of worker threads. Each run is single threaded
+// and sees the commands in log order, so results do not depend on the thread count.
+int RunSimulation(const char* path, std::vector<SimulationConfig> configs, uint32 threads, uint32 depth, const ContractSpec& contract){
+    auto start = std::chrono::steady_clock::now();
+    std::vector<OrderCommand> commands;
+    std::unordered_map<uint32, Side> sides;
+    uint64 skipped = 0;
+    uint64 messages = 0;
+    uint64 rejected = 0;
+    auto load = [&](OrderCommand& command, RejectReason status){
+        messages++;
+        if(status != RejectReason::None){
+            rejected++;
+            return;
+        }
+        // Replaces carry no side; take it from the order they replace, for tick rounding.
+        if(command.type == CommandType::New){
+            sides[command.orderId] = command.side;
+        }else if(command.type == CommandType::Replace){
+            auto it = sides.find(command.origOrderId);
+            command.side = it != sides.end() ? it -> second : Side::Buy;
+            sides[command.orderId] = command.side;
+        }
+        commands.push_back(command);
+    };
+    bool opened = ForEachMessage(path, skipped, [&](std::string_view line){
+        OrderCommand command;
+        RejectReason status = DecodeFix(line, command, contract);
+        load(command, status);
+    }, [&](const unsigned char* data, size_t size){
+        OrderCommand command;
+        RejectReason status = DecodeBinary(data, size, command);
+        load(command, status);
+    });
+    if(!opened){
+        std::cout << "Could not open " << path << std::endl;
+        return 1;
+    }
+    double loadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if(configs.empty()){
+        for(const char* spec : {"", "price=aggressor", "tick=2", "tick=4", "ioc=25", "ioc=50"}){
+            configs.emplace_back();
+            SimulationConfig::parse(spec, configs.back());
+        }
+    }
+    std::vector<SimulationResult> results(configs.size());
+    std::atomic<size_t> next{0};
+    auto worker = [&](){
+        for(size_t run = next.fetch_add(1); run < configs.size(); run = next.fetch_add(1)){
+            const SimulationConfig& config = configs[run];
+            SimulationResult& result = results[run];
+            auto runStart = std::chrono::steady_clock::now();
+            auto book = std::make_unique<Orderbook>(contract.bookCapacity(Orderbook::defaultOrderCapacity));
+            book -> setPriceRule(config.priceRule);
+            book -> setContract(contract);
+            auto record = [&](const ExecutionReport& report){ result.record(report); };
+            book -> setReportSink(record);
+            book -> setDepthSink([](const DepthUpdate&){});
+            for(const OrderCommand& recorded : commands){
+                OrderCommand command = recorded;
+                config.apply(command);
+                book -> Execute(command);
+                book -> DrainReports(record);
+                book -> DrainDepth([](const DepthUpdate&){});
+            }
+            result.stats.messages = messages;
+            result.stats.skipped = skipped;
+            result.stats.rejects += rejected;
+            result.resting = book -> getOrderCount();
+            result.levels = book -> GetBookLevels(depth);
+            result.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+        }
+    };
+    threads = std::max<uint32>(1, std::min<uint32>(threads, static_cast<uint32>(configs.size())));
+    std::vector<std::thread> pool;
+    for(uint32 i = 1; i < threads; i++){
+        pool.emplace_back(worker);
+    }
+    worker();
+    for(std::thread& thread : pool){
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double runTime = 0;
+    for(const SimulationResult& result : results){
+        runTime += result.elapsed;
+    }
+    std::cout << "Loaded " << commands.size() << " commands (" << rejected << " rejected, " << skipped << " lines skipped) in "
+              << loadTime << " s; ran " << configs.size() << " configurations on " << threads << " threads in "
+              << elapsed - loadTime << " s (" << runTime << " s of runs)\n";
+    std::cout << std::left << std::setw(32) << "config" << std::right << std::setw(10) << "fills" << std::setw(12) << "volume"
+              << std::setw(12) << "vwap" << std::setw(10) << "kills" << std::setw(10) << "resting" << std::setw(10) << "bid"
+              << std::setw(10) << "ask" << std::setw(12) << "same fills" << std::setw(12) << "depth diff" << std::setw(10) << "ms" << "\n";
+    const SimulationResult& baseline = results[0];
+    for(size_t run = 0; run < results.size(); run++){
+        const SimulationResult& result = results[run];
+        const priceLevels& bids = result.levels.getBids();
+        const priceLevels& asks = result.levels.getAsks();
+        std::cout << std::left << std::setw(32) << configs[run].name << std::right << std::setw(10) << result.stats.fills
+                  << std::setw(12) << result.volume << std::setw(12) << std::fixed << std::setprecision(2) << result.getVwap(contract.ticksPerPoint)
+                  << std::setw(10) << result.stats.kills << std::setw(10) << result.resting;
+        for(const priceLevels* side : {&bids, &asks}){
+            char price[32];
+            std::cout << std::setw(10) << (side -> empty() ? std::string_view("-") : contract.format(side -> front().price, price));
+        }
+        std::cout << std::setw(12) << (result.fillDigest == baseline.fillDigest && result.stats.fills == baseline.stats.fills ? "yes" : "no")
+                  << std::setw(12) << CountDepthDifferences(result.levels, baseline.levels)
+                  << std::setw(10) << result.elapsed * 1000.0 << std::defaultfloat << "\n";
+    }
+    std::cout << std::flush;
+    return 0;
+}
+
+// Synthetic order flow against a book preloaded with a given number of resting orders.
+// Every call is timed on its own and sorted into a histogram by what it ended up doing.
+class Benchmark{
+private:
+    static constexpr Tick startMid = 4000;
+
+    Orderbook book_;
+    std::mt19937_64 rng_;
+    Tick mid_ = startMid;
+    Tick halfWidth_;
+    uint32 nextId_ = 1;
+    std::vector<uint32> live_;
+    std::vector<uint32> livePos_;
+    bool matched_ = false;
+    uint32 removed_ = 0;
+
+    LatencyHistogram addRest_;
+    LatencyHistogram addMatch_;
+    LatencyHistogram addKill_;
+    LatencyHistogram cancel_;
+    LatencyHistogram parse_;
+    LatencyHistogram massCancel_;
+    uint64 start_ = 0;
+
+    static uint64 now(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    uint32 random(uint32 bound){ return static_cast<uint32>(rng_() % bound); }
+
+    void track(uint32 orderId){
+        livePos_[orderId] = static_cast<uint32>(live_.size());
+        live_.push_back(orderId);
+    }
+
+    void untrack(uint32 orderId){
+        uint32 pos = livePos_[orderId];
+        if(pos == nullHandle){
+            return;
+        }
+        live_[pos] = live_.back();
+        livePos_[live_[pos]] = pos;
+        live_.pop_back();
+        livePos_[orderId] = nullHandle;
+        removed_++;
+    }
+
+    void drain(){
+        matched_ = false;
+        book_.DrainReports([&](const ExecutionReport& report){
+            switch(report.type){
+            case ExecType::Ack: track(report.orderId); break;
+            case ExecType::Fill:
+                matched_ = true;
+                if(report.leaves == 0){
+                    untrack(report.orderId);
+                }
+                break;
+            case ExecType::Kill: untrack(report.orderId); break;
+            case ExecType::Cancel: untrack(report.orderId); break;
+            default: break;
+            }
+        });
+    }
+
+    void add(OrderType type, Side side, Tick price, uint32 quantity){
+        Order order = Order::fromTicks(type, side, nextId_++, price, quantity);
+        if(nextId_ >= livePos_.size()){
+            livePos_.resize(2 * livePos_.size(), nullHandle);
+        }
+        uint64 t0 = now();
+        book_.AddOrder(order);
+        uint64 elapsed = now() - t0;
+        drain();
+        if(matched_){
+            addMatch_.record(elapsed);
+        }else if(type != OrderType::GoodTillFill){
+            addKill_.record(elapsed);
+        }else{
+            addRest_.record(elapsed);
+        }
+    }
+
+    void cancelRandom(){
+        if(live_.empty()){
+            return;
+        }
+        uint32 orderId = live_[random(static_cast<uint32>(live_.size()))];
+        uint64 t0 = now();
+        book_.CancelOrder(orderId);
+        uint64 elapsed = now() - t0;
+        cancel_.record(elapsed);
+        drain();
+    }
+
+    void addPassive(){
+        Side side = random(2) ? Side::Buy : Side::Sell;
+        Tick offset = 1 + static_cast<Tick>(random(static_cast<uint32>(halfWidth_)));
+        add(OrderType::GoodTillFill, side, side == Side::Buy ? mid_ - offset : mid_ + offset, 1 + random(10));
+    }
+
+public:
+    Benchmark(uint32 depth, uint32 ops, uint64 seed):
+        book_ (depth + ops + 1024),
+        rng_ (seed),
+        halfWidth_ (static_cast<Tick>(std::clamp<uint32>(depth / 20, 4, 1000))),
+        livePos_ (static_cast<size_t>(depth) + 4ull * ops + 1, nullHandle)
+        {
+            live_.reserve(depth + ops);
+            while(live_.size() < depth){
+                addPassive();
+            }
+            addRest_.reset();
+        }
+
+        void randomWalk(uint32 ops){
+            for(uint32 i = 0; i < ops; i++){
+                if(random(10) == 0){
+                    mid_ += random(2) ? 1 : -1;
+                }
+                uint32 action = random(10);
+                if(action < 5){
+                    addPassive();
+                }else if(action < 7){
+                    Side side = random(2) ? Side::Buy : Side::Sell;
+                    Tick through = static_cast<Tick>(random(3));
+                    add(OrderType::GoodTillFill, side, side == Side::Buy ? mid_ + through : mid_ - through, 1 + random(10));
+                }else{
+                    cancelRandom();
+                }
+            }
+        }
+
+        void cancelReplace(uint32 ops){
+            for(uint32 i = 0; i < ops; i++){
+                cancelRandom();
+                addPassive();
+            }
+        }
+
+        void sweep(uint32 ops){
+            uint32 perLevel = std::max<uint32>(1, static_cast<uint32>(live_.size()) / (2 * static_cast<uint32>(halfWidth_)));
+            for(uint32 i = 0; i < ops; i++){
+                Side side = random(2) ? Side::Buy : Side::Sell;
+                Tick levels = 1 + static_cast<Tick>(random(5));
+                removed_ = 0;
+                add(OrderType::GoodTillFill, side, side == Side::Buy ? mid_ + levels : mid_ - levels, perLevel * 6 * static_cast<uint32>(levels));
+                uint32 refill = removed_;
+                for(uint32 j = 0; j < refill; j++){
+                    addPassive();
+                }
+            }
+        }
+
+        void fillOrKill(uint32 ops){
+            for(uint32 i = 0; i < ops; i++){
+                if(random(10) < 7){
+                    Side side = random(2) ? Side::Buy : Side::Sell;
+                    Tick through = static_cast<Tick>(random(5)) - 2;
+                    add(OrderType::FillOrKill, side, side == Side::Buy ? mid_ + through : mid_ - through, 1 + random(20));
+                }else{
+                    addPassive();
+                }
+            }
+        }
+
+        // Clears the whole book with one mass cancel and rebuilds it, recording the cost per
+        // order cancelled, to set against the single-order cancel rows.
+        void massCancel(uint32 ops){
+            uint32 rounds = std::max<uint32>(1, ops / std::max<uint32>(1000, static_cast<uint32>(live_.size())));
+            for(uint32 round = 0; round < rounds; round++){
+                uint32 depth = static_cast<uint32>(live_.size());
+                if(depth == 0){
+                    break;
+                }
+                uint64 t0 = now();
+                book_.MassCancel(nextId_++, CancelScope{});
+                massCancel_.record((now() - t0) / depth);
+                book_.DrainReports([](const ExecutionReport&){});
+                for(uint32 orderId : live_){
+                    livePos_[orderId] = nullHandle;
+                }
+                live_.clear();
+                while(live_.size() < depth){
+                    addPassive();
+                }
+            }
+            addRest_.reset();
+        }
+
+        void parse(const std::vector<std::string>& messages){
+            FixMessage fix;
+            for(const std::string& msg : messages){
+                uint64 t0 = now();
+                fix.parse(msg);
+                parse_.record(now() - t0);
+            }
+        }
+
+        void decodeFix(const std::vector<std::string>& messages){
+            OrderCommand command;
+            for(const std::string& msg : messages){
+                uint64 t0 = now();
+                DecodeFix(msg, command);
+                parse_.record(now() - t0);
+            }
+        }
+
+        void decodeBinary(const std::vector<unsigned char>& frames){
+            OrderCommand command;
+            for(size_t offset = 0; offset < frames.size();){
+                size_t size = binaryHeaderSize + static_cast<size_t>(getLE(frames.data() + offset, 2));
+                uint64 t0 = now();
+                DecodeBinary(frames.data() + offset, size, command);
+                parse_.record(now() - t0);
+                offset += size;
+            }
+        }
+
+        // The same orders as makeMessages, binary encoded back to back.
+        static std::vector<unsigned char> encodeMessages(const std::vector<std::string>& messages){
+            std::vector<unsigned char> frames;
+            frames.reserve(messages.size() * binaryMaxMessageSize);
+            unsigned char frame[binaryMaxMessageSize];
+            for(const std::string& msg : messages){
+                OrderCommand command;
+                if(DecodeFix(msg, command) == RejectReason::None){
+                    frames.insert(frames.end(), frame, frame + EncodeBinary(command, frame));
+                }
+            }
+            return frames;
+        }
+
+        static std::vector<std::string> makeMessages(uint32 count, uint64 seed){
+            std::mt19937_64 rng(seed);
+            std::vector<std::string> messages;
+            messages.reserve(count);
+            for(uint32 i = 0; i < count; i++){
+                Tick price = startMid + static_cast<Tick>(rng() % 41) - 20;
+                char text[32];
+                std::string body = "35=D|49=CLIENT|56=BROKER|34=2|52=20231010-10:30:00.000|11=" + std::to_string(i + 1)
+                    + "|21=" + std::to_string(1 + rng() % 2) + "|55=TICK|54=" + std::to_string(1 + rng() % 2)
+                    + "|38=" + std::to_string(1 + rng() % 50) + "|40=2|44=" + std::string(defaultContract.format(price, text)) + "|59=0|";
+                std::string msg = "8=FIX.4.4|9=" + std::to_string(body.size()) + "|" + body;
+                uint32 sum = 0;
+                for(char c : msg){
+                    sum += c == '|' ? 1 : static_cast<unsigned char>(c);
+                }
+                std::string checkSum = std::to_string(sum % 256);
+                msg += "10=" + std::string(3 - checkSum.size(), '0') + checkSum + "|";
+                messages.push_back(std::move(msg));
+            }
+            return messages;
+        }
+
+        static void printHeader(){
+            std::cout << std::left << std::setw(16) << "workload" << std::setw(10) << "depth" << std::setw(12) << "op"
+                      << std::right << std::setw(10) << "count" << std::setw(14) << "ops/sec" << std::setw(10) << "p50"
+                      << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(12) << "max (ns)" << "\n";
+        }
+
+        void print(const char* workload, uint32 depth) const {
+            const std::pair<const char*, const LatencyHistogram*> rows[] = {
+                {"add-rest", &addRest_}, {"add-match", &addMatch_}, {"add-kill", &addKill_}, {"cancel", &cancel_}, {"mass-cancel", &massCancel_},
+                {"parse", &parse_}};
+            for(const auto& [name, hist] : rows){
+                if(hist -> count() == 0){
+                    continue;
+                }
+                std::cout << std::left << std::setw(16) << workload << std::setw(10) << depth << std::setw(12) << name
+                          << std::right << std::setw(10) << hist -> count()
+                          << std::setw(14) << static_cast<uint64>(hist -> sum() ? hist -> count() * 1e9 / hist -> sum() : 0)
+                          << std::setw(10) << hist -> percentile(50) << std::setw(10) << hist -> percentile(99)
+                          << std::setw(10) << hist -> percentile(99.9) << std::setw(12) << hist -> max() << "\n";
+            }
+        }
+};
+
+int RunBenchmarks(uint32 ops, uint32 maxDepth){
+    Benchmark::printHeader();
+    for(uint32 depth : {10u, 1000u, 100000u, 1000000u}){
+        if(depth > maxDepth){
+            break;
+        }
+        struct Workload{
+            const char* name;
+            void (Benchmark::*run)(uint32);
+            uint32 ops;
+        };
+        const Workload workloads[] = {
+            {"random-walk", &Benchmark::randomWalk, ops},
+            {"cancel-replace", &Benchmark::cancelReplace, ops},
+            {"sweep", &Benchmark::sweep, std::max<uint32>(1, ops / 100)},
+            {"fok-heavy", &Benchmark::fillOrKill, ops},
+            {"bulk-cancel", &Benchmark::massCancel, ops},
+        };
+        for(const Workload& workload : workloads){
+            Benchmark bench(depth, workload.ops, depth);
+            (bench.*workload.run)(workload.ops);
+            bench.print(workload.name, depth);
+        }
+        std::cout.flush();
+    }
+
+    std::vector<std::string> messages = Benchmark::makeMessages(ops, 1);
+    Benchmark parse(0, 0, 1);
+    parse.parse(messages);
+    parse.print("fix-parse", 0);
+    Benchmark fixDecode(0, 0, 1);
+    fixDecode.decodeFix(messages);
+    fixDecode.print("fix-decode", 0);
+    Benchmark binaryDecode(0, 0, 1);
+    binaryDecode.decodeBinary(Benchmark::encodeMessages(messages));
+    binaryDecode.print("binary-decode", 0);
+    std::cout << std::flush;
+    return 0;
+}
+
+// Converts a FIX log to the binary encoding, dropping lines that are not FIX or do not decode.
+int EncodeLog(const char* fixPath, const char* binaryPath, const ContractTable& contracts){
+    std::ofstream out(binaryPath, std::ios::binary | std::ios::trunc);
+    if(!out){
+        std::cout << "Could not open " << binaryPath << std::endl;
+        return 1;
+    }
+    uint64 encoded = 0;
+    uint64 skipped = 0;
+    unsigned char frame[binaryMaxMessageSize];
+    bool opened = ForEachLine(fixPath, [&](std::string_view line){
+        OrderCommand command;
+        if(!IsFixLine(line) || DecodeFix(line, command, contracts) != RejectReason::None){
+            skipped++;
+            return;
+        }
+        out.write(reinterpret_cast<const char*>(frame), static_cast<std::streamsize>(EncodeBinary(command, frame)));
+        encoded++;
+    });
+    if(!opened){
+        std::cout << "Could not open " << fixPath << std::endl;
+        return 1;
+    }
+    std::cout << "Encoded " << encoded << " messages, skipped " << skipped << " lines" << std::endl;
+    return out ? 0 : 1;
+}
+
+// Adds one --contract argument to the table, complaining if it does not parse.
+bool AddContract(const char* text, ContractTable& contracts){
+    ContractSpec spec;
+    if(!parseContract(text, spec)){
+        std::cout << "Bad contract " << text << " (expected e.g. ZN:tick=0.015625,low=100,high=130,max=5000)" << std::endl;
+        return false;
+    }
+    contracts.add(spec);
+    return true;
+}
+
+// tests/orderbook_test.cpp includes this file with ORDERBOOK_NO_MAIN defined to drive the
+// book directly.
+#ifndef ORDERBOOK_NO_MAIN
+int main(int argc, char* argv[])
+{
+    if(argc >= 3 && std::string_view(argv[1]) == "--replay"){
+        ReplayOptions options;
+        for(int i = 3; i < argc; i++){
+            std::string_view arg = argv[i];
+            if(arg == "--print"){
+                options.printReports = true;
+            }else if(arg == "--shards" && i + 1 < argc){
+                parseUint(argv[++i], options.shards);
+            }else if(arg == "--orders" && i + 1 < argc){
+                if(!parseUint(argv[++i], options.orderCapacity) || options.orderCapacity == 0){
+                    std::cout << "Bad book capacity " << argv[i] << std::endl;
+                    return 1;
+                }
+            }else if(arg == "--md" && i + 1 < argc){
+                options.depthPath = argv[++i];
+            }else if(arg == "--trades" && i + 1 < argc){
+                options.tradesPath = argv[++i];
+            }else if(arg == "--journal" && i + 1 < argc){
+                options.journalPath = argv[++i];
+            }else if(arg == "--snapshot" && i + 1 < argc){
+                options.snapshotPath = argv[++i];
+            }else if(arg == "--snapshot-every" && i + 1 < argc){
+                parseUint(argv[++i], options.snapshotEvery);
+            }else if(arg == "--stats" && i + 1 < argc){
+                options.statsPath = argv[++i];
+            }else if(arg == "--stats-every" && i + 1 < argc){
+                parseUint(argv[++i], options.statsEvery);
+            }else if(arg == "--stats-sample" && i + 1 < argc){
+                parseUint(argv[++i], options.statsSample);
+            }else if(arg == "--pipeline"){
+                options.pipeline = true;
+            }else if(arg == "--spin"){
+                options.wait = WaitPolicy::Spin;
+            }else if(arg == "--pin" && i + 3 < argc){
+                uint32 core = 0;
+                options.ingestCore = parseUint(argv[++i], core) ? static_cast<int32>(core) : -1;
+                options.matchCore = parseUint(argv[++i], core) ? static_cast<int32>(core) : -1;
+                options.outputCore = parseUint(argv[++i], core) ? static_cast<int32>(core) : -1;
+            }else if(arg == "--contract" && i + 1 < argc){
+                if(!AddContract(argv[++i], options.contracts)){
+                    return 1;
+                }
+            }else if(arg == "--risk" && i + 1 < argc){
+                if(!RiskLimits::parse(argv[++i], options.risk)){
+                    std::cout << "Bad risk limits " << argv[i] << " (expected e.g. size=100,open=1000,distance=40,stp=cancel-resting)" << std::endl;
+                    return 1;
+                }
+            }
+        }
+        if((options.pipeline || options.shards > 0) && (options.journalPath != nullptr || options.snapshotPath != nullptr
+            || options.depthPath != nullptr || options.tradesPath != nullptr)){
+            std::cout << "--journal, --snapshot, --md and --trades need the single-threaded replay; drop --pipeline and --shards" << std::endl;
+            return 1;
+        }
+        if(options.pipeline){
+            return RunPipelinedReplay(argv[2], options);
+        }
+        if(options.shards > 0){
+            return RunShardedReplay(argv[2], options);
+        }
+        return RunReplay(argv[2], options);
+    }
+    if(argc >= 3 && std::string_view(argv[1]) == "--simulate"){
+        std::vector<SimulationConfig> configs;
+        ContractTable contracts;
+        uint32 threads = std::max(1u, std::thread::hardware_concurrency());
+        uint32 depth = 10;
+        for(int i = 3; i < argc; i++){
+            std::string_view arg = argv[i];
+            if(arg == "--threads" && i + 1 < argc){
+                parseUint(argv[++i], threads);
+            }else if(arg == "--depth" && i + 1 < argc){
+                parseUint(argv[++i], depth);
+            }else if(arg == "--config" && i + 1 < argc){
+                configs.emplace_back();
+                if(!SimulationConfig::parse(argv[++i], configs.back())){
+                    std::cout << "Bad config " << argv[i] << " (expected e.g. price=aggressor,tick=2,ioc=25)" << std::endl;
+                    return 1;
+                }
+            }else if(arg == "--contract" && i + 1 < argc){
+                if(!AddContract(argv[++i], contracts)){
+                    return 1;
+                }
+            }
+        }
+        return RunSimulation(argv[2], configs, threads, depth, contracts.primary());
+    }
+    if(argc >= 4 && std::string_view(argv[1]) == "--encode"){
+        ContractTable contracts;
+        for(int i = 4; i + 1 < argc; i += 2){
+            if(std::string_view(argv[i]) == "--contract" && !AddContract(argv[i + 1], contracts)){
+                return 1;
+            }
+        }
+        return EncodeLog(argv[2], argv[3], contracts);
+    }
+    if(argc >= 2 && std::string_view(argv[1]) == "--bench"){
+        uint32 ops = 200000;
+        uint32 maxDepth = 1000000;
+        if(argc >= 3){
+            parseUint(argv[2], ops);
+        }
+        if(argc >= 4){
+            parseUint(argv[3], maxDepth);
+        }
+        return RunBenchmarks(ops, maxDepth);
+    }
+
+    // Input stays on this thread and matching and printing run behind the gateway; every
+    // command is flushed so its reports print before the menu comes back.
+    Gateway gateway([](const ExecutionReport& report){ PrintReport(report, std::cout); });
+    while(true){
+    std::string input;
+    
+    std::cout << "C++ Orderbook and Visual DOM" << std::endl;
+    std::cout << "============================" << std::endl;
+    std::cout << "1. Submit Order" << std::endl;
+    std::cout << "2. Print Visual DOM" << std::endl;
+    std::cout << "3. Populate Orderbook" << std::endl;
+    std::cout << "4. Print Engine Stats" << std::endl;
+    std::getline(std::cin, input);
+
+    if(input == "1"){
+        std::string order;
+        std::cout << "Enter your order" << std::endl; 
+        std::getline(std::cin, order);
+        gateway.Submit(order);
+        gateway.Flush();
+    }else if(input == "2"){
+        gateway.WithBook([](Orderbook& orderbook){ orderbook.PrintDom(); });
+    }else if(input == "3"){
+        gateway.WithBook([](Orderbook& orderbook){ orderbook.populateOrderBook(); });
+    }else if(input == "4"){
+        gateway.WithBook([](Orderbook& orderbook){ orderbook.getStats().Print(std::cout); });
+    }else{
+        std::cout << "Invalid Input" << std::endl;
+        
+    }
+    std::cout.flush();
+    
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,852 @@
+// Drives the order book through FIX messages and checks the exact execution reports it emits.
+// Build and run with `make test`, or by hand:
+//   g++ -std=c++17 -O2 -Wall -Wextra -pthread -o tests/orderbook_test tests/orderbook_test.cpp && ./tests/orderbook_test
+#define ORDERBOOK_NO_MAIN
+#include "../main.cpp"
+
+#include <map>
+
+namespace {
+
+uint32 failures = 0;
+
+#define CHECK(condition) \
+    do{ \
+        if(!(condition)){ \
+            std::cout << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+            failures++; \
+        } \
+    }while(false)
+
+// Values of tag 21 (order type) and 54 (side).
+const char* const fok = "1";
+const char* const gtf = "2";
+const char* const ioc = "3";
+const char* const buy = "1";
+const char* const sell = "2";
+
+// Wraps a body such as "35=D|11=1|...|" in 8 and 9 and appends a valid 10, with '|'
+// standing in for SOH.
+std::string Fix(std::string_view body){
+    std::string msg = "8=FIX.4.4|9=" + std::to_string(body.size()) + "|" + std::string(body);
+    uint32 sum = 0;
+    for(char c : msg){
+        sum += c == '|' ? 1 : static_cast<unsigned char>(c);
+    }
+    char checkSum[4];
+    std::snprintf(checkSum, sizeof(checkSum), "%03u", sum % 256);
+    return msg + "10=" + checkSum + "|";
+}
+
+std::string NewOrderOn(std::string_view symbol, uint32 orderId, const char* side, const char* orderType, std::string_view price, uint32 quantity,
+    std::string_view extra = {}){
+    return Fix("35=D|11=" + std::to_string(orderId) + "|21=" + orderType + "|55=" + std::string(symbol) + "|54=" + side + "|38="
+        + std::to_string(quantity) + "|40=2|44=" + std::string(price) + "|59=0|" + std::string(extra));
+}
+
+std::string NewOrder(uint32 orderId, const char* side, const char* orderType, std::string_view price, uint32 quantity, std::string_view extra = {}){
+    return NewOrderOn("ES", orderId, side, orderType, price, quantity, extra);
+}
+
+std::string CancelOrder(uint32 orderId){
+    return Fix("35=F|41=" + std::to_string(orderId) + "|55=ES|");
+}
+
+std::string ReplaceOrder(uint32 origOrderId, uint32 orderId, std::string_view price, uint32 quantity){
+    return Fix("35=G|41=" + std::to_string(origOrderId) + "|11=" + std::to_string(orderId) + "|55=ES|38=" + std::to_string(quantity)
+        + "|44=" + std::string(price) + "|");
+}
+
+// 40=3 is a stop (market once triggered), 40=4 a stop-limit at price; 99 is the stop price.
+std::string StopOrder(uint32 orderId, const char* side, const char* stopType, std::string_view stop, std::string_view price, uint32 quantity){
+    return Fix("35=D|11=" + std::to_string(orderId) + "|21=2|55=ES|54=" + side + "|38=" + std::to_string(quantity) + "|40=" + stopType
+        + (price.empty() ? "" : "|44=" + std::string(price)) + "|99=" + std::string(stop) + "|59=0|");
+}
+
+Tick px(std::string_view text){
+    Tick ticks = 0;
+    if(!defaultContract.parseTicks(text, ticks)){
+        std::cout << "Bad test price " << text << "\n";
+        failures++;
+    }
+    return ticks;
+}
+
+struct Expected{
+    ExecType type;
+    uint32 orderId;
+    Tick price;
+    uint32 quantity;
+    uint32 leaves;
+    RejectReason reason = RejectReason::None;
+};
+
+void Print(ExecType type, uint32 orderId, Tick price, uint32 quantity, uint32 leaves, RejectReason reason){
+    std::cout << "    type " << static_cast<int>(type) << " order# " << orderId << " price " << price << " quantity " << quantity
+        << " leaves " << leaves << " reason " << static_cast<int>(reason) << "\n";
+}
+
+std::vector<ExecutionReport> Run(Orderbook& book, std::string_view msg){
+    std::vector<ExecutionReport> reports;
+    book.ParseMessage(msg);
+    book.DrainReports([&](const ExecutionReport& report){ reports.push_back(report); });
+    return reports;
+}
+
+// Submits msg and compares type, order id, price, quantity, leaves and reject reason of
+// every report it produces.
+void Expect(const char* name, Orderbook& book, std::string_view msg, const std::vector<Expected>& expected){
+    std::vector<ExecutionReport> reports = Run(book, msg);
+    bool same = reports.size() == expected.size();
+    for(size_t i = 0; same && i < reports.size(); i++){
+        const ExecutionReport& got = reports[i];
+        const Expected& want = expected[i];
+        same = got.type == want.type && got.orderId == want.orderId && got.price == want.price && got.quantity == want.quantity
+            && got.leaves == want.leaves && got.reason == want.reason;
+    }
+    if(!same){
+        std::cout << name << ": unexpected reports\n  got:\n";
+        for(const ExecutionReport& got : reports){
+            Print(got.type, got.orderId, got.price, got.quantity, got.leaves, got.reason);
+        }
+        std::cout << "  expected:\n";
+        for(const Expected& want : expected){
+            Print(want.type, want.orderId, want.price, want.quantity, want.leaves, want.reason);
+        }
+        failures++;
+    }
+}
+
+void Rest(Orderbook& book, uint32 orderId, const char* side, std::string_view price, uint32 quantity, std::string_view extra = {}){
+    Expect("rest", book, NewOrder(orderId, side, gtf, price, quantity, extra), {{ExecType::Ack, orderId, px(price), quantity, quantity}});
+}
+
+void TestFixValidation(){
+    Orderbook book;
+    std::string valid = NewOrder(1, buy, gtf, "99.50", 10);
+    Expect("valid message", book, valid, {{ExecType::Ack, 1, px("99.50"), 10, 10}});
+
+    std::string soh = NewOrder(2, buy, gtf, "99.50", 10);
+    std::replace(soh.begin(), soh.end(), '|', '\x01');
+    Expect("SOH delimiters", book, soh, {{ExecType::Ack, 2, px("99.50"), 10, 10}});
+
+    std::string longer = NewOrder(3, buy, gtf, "99.50", 10);
+    size_t length = longer.find("|9=") + 3;
+    longer.replace(length, longer.find('|', length) - length, std::to_string(std::stoul(longer.substr(length)) + 1));
+    Expect("BodyLength (9) one too long", book, longer, {{ExecType::Reject, 3, 0, 0, 0, RejectReason::BadBodyLength}});
+
+    std::string corrupt = NewOrder(4, buy, gtf, "99.50", 10);
+    size_t sum = corrupt.rfind("10=") + 3;
+    corrupt.replace(sum, 3, corrupt.compare(sum, 3, "000") == 0 ? "001" : "000");
+    Expect("CheckSum (10) wrong", book, corrupt, {{ExecType::Reject, 4, 0, 0, 0, RejectReason::BadCheckSum}});
+
+    std::string tampered = NewOrder(5, buy, gtf, "99.50", 10);
+    tampered.replace(tampered.find("38=10"), 5, "38=90");
+    Expect("body changed after the checksum", book, tampered, {{ExecType::Reject, 5, 0, 0, 0, RejectReason::BadCheckSum}});
+
+    Expect("no CheckSum", book, "8=FIX.4.4|9=5|35=D|", {{ExecType::Reject, 0, 0, 0, 0, RejectReason::MalformedMessage}});
+    CHECK(book.getOrderCount() == 2);
+}
+
+void TestParseTicks(){
+    Tick ticks = 0;
+    CHECK(defaultContract.parseTicks("100.25", ticks) && ticks == 401);
+    CHECK(defaultContract.parseTicks("99", ticks) && ticks == 396);
+    CHECK(defaultContract.parseTicks("0.500000000", ticks) && ticks == 2);
+    CHECK(defaultContract.parseTicks("-1.75", ticks) && ticks == -7);
+    CHECK(!defaultContract.parseTicks("100.1", ticks));
+    CHECK(!defaultContract.parseTicks("1.0000000000", ticks));
+    CHECK(!defaultContract.parseTicks("1.2.5", ticks));
+    CHECK(!defaultContract.parseTicks("12a", ticks));
+    CHECK(!defaultContract.parseTicks("", ticks));
+    CHECK(!defaultContract.parseTicks("-", ticks));
+    CHECK(!defaultContract.parseTicks("999999999999", ticks));
+}
+
+// Crossing prices on different symbols must not trade, and each symbol keeps its own book,
+// sized by its contract or the engine default, whichever shard it lands on.
+void TestMatchingEngineRouting(){
+    std::vector<SymbolReport> reports;
+    ContractTable contracts;
+    ContractSpec nq;
+    CHECK(parseContract("NQ:orders=16", nq));
+    contracts.add(nq);
+    MatchingEngine engine(2, [&](const SymbolReport& report){ reports.push_back(report); }, contracts, RiskLimits{}, 1024, 64);
+    engine.Submit(NewOrderOn("ES", 1, buy, gtf, "100", 10));
+    engine.Submit(NewOrderOn("NQ", 1, sell, gtf, "100", 10));
+    engine.Submit(NewOrderOn("YM", 7, sell, gtf, "100", 3));
+    engine.Flush();
+    CHECK(reports.size() == 3);
+    for(const SymbolReport& got : reports){
+        CHECK(got.report.type == ExecType::Ack);
+    }
+
+    reports.clear();
+    engine.Submit(NewOrderOn("ES", 2, sell, gtf, "100", 4));
+    engine.Submit(Fix("35=D|11=3|21=2|54=1|38=1|40=2|44=100|59=0|"));
+    engine.Flush();
+    CHECK(engine.getSymbolCount() == 3);
+    CHECK(engine.getSymbolName(0) == "ES" && engine.getSymbolName(1) == "NQ" && engine.getSymbolName(2) == "YM");
+    uint32 fills = 0;
+    for(const SymbolReport& got : reports){
+        if(got.report.type == ExecType::Fill){
+            CHECK(got.symbolId == 0);
+            fills++;
+        }
+        if(got.report.type == ExecType::Reject){
+            CHECK(got.symbolId == MatchingEngine::unknownSymbol && got.report.orderId == 3 && got.report.reason == RejectReason::InvalidSymbol);
+        }
+    }
+    CHECK(fills == 2);
+    CHECK(reports.size() == 4);
+    CHECK(engine.getBook(0).getOrderCount() == 1);
+    CHECK(engine.getBook(1).getOrderCount() == 1);
+    CHECK(engine.getBook(2).getOrderCount() == 1);
+    CHECK(engine.getBook(0).getOrderCapacity() == 1024 && engine.getBook(1).getOrderCapacity() == 16 && engine.getBook(2).getOrderCapacity() == 1024);
+}
+
+void TestCancelReplace(){
+    Orderbook book;
+    Rest(book, 1, sell, "100", 10);
+    Rest(book, 2, sell, "100", 5);
+    Expect("partial fill of the first in the queue", book, NewOrder(3, buy, gtf, "100", 4), {
+        {ExecType::Ack, 3, px("100"), 4, 4},
+        {ExecType::Fill, 3, px("100"), 4, 0},
+        {ExecType::Fill, 1, px("100"), 4, 6}});
+
+    // 38 is the new total, so 4 of the 8 are already filled and the order keeps its place.
+    Expect("replace down keeps priority", book, ReplaceOrder(1, 11, "100", 8), {{ExecType::Replace, 11, px("100"), 8, 4}});
+    Expect("sweep after the replace", book, NewOrder(4, buy, gtf, "100", 5), {
+        {ExecType::Ack, 4, px("100"), 5, 5},
+        {ExecType::Fill, 4, px("100"), 4, 1},
+        {ExecType::Fill, 11, px("100"), 4, 0},
+        {ExecType::Fill, 4, px("100"), 1, 0},
+        {ExecType::Fill, 2, px("100"), 1, 4}});
+    Expect("old id is gone", book, CancelOrder(1), {{ExecType::Reject, 1, 0, 0, 0, RejectReason::UnknownOrderId}});
+    Expect("cancel", book, CancelOrder(2), {{ExecType::Cancel, 2, px("100"), 5, 4}});
+    Expect("cancel twice", book, CancelOrder(2), {{ExecType::Reject, 2, 0, 0, 0, RejectReason::UnknownOrderId}});
+
+    Rest(book, 5, sell, "101", 3);
+    Rest(book, 6, sell, "101", 3);
+    Expect("replace up loses priority", book, ReplaceOrder(5, 5, "101", 4), {{ExecType::Replace, 5, px("101"), 4, 4}});
+    Expect("fills the order that was behind", book, NewOrder(7, buy, gtf, "101", 3), {
+        {ExecType::Ack, 7, px("101"), 3, 3},
+        {ExecType::Fill, 7, px("101"), 3, 0},
+        {ExecType::Fill, 6, px("101"), 3, 0}});
+    Expect("replace to a new price and id", book, ReplaceOrder(5, 8, "99", 4), {{ExecType::Replace, 8, px("99"), 4, 4}});
+    Rest(book, 9, buy, "98", 2);
+    Expect("replace onto a live id", book, ReplaceOrder(8, 9, "99", 4), {{ExecType::Reject, 9, 0, 0, 0, RejectReason::DuplicateOrderId}});
+    CHECK(book.getOrderCount() == 2);
+}
+
+std::vector<DepthUpdate> Depth(Orderbook& book){
+    std::vector<DepthUpdate> updates;
+    book.DrainDepth([&](const DepthUpdate& update){ updates.push_back(update); });
+    return updates;
+}
+
+bool IsUpdate(const DepthUpdate& update, uint64 sequence, DepthAction action, Side side, Tick price, uint32 quantity){
+    return update.sequence == sequence && update.action == action && update.side == side && update.price == price && update.quantity == quantity;
+}
+
+// Each command publishes every level it touched once, with its final size, and sequence
+// numbers run on without gaps.
+void TestDepthConflation(){
+    Orderbook book;
+    Rest(book, 1, buy, "99", 10);
+    std::vector<DepthUpdate> updates = Depth(book);
+    CHECK(updates.size() == 1 && IsUpdate(updates[0], 1, DepthAction::Add, Side::Buy, px("99"), 10));
+
+    Rest(book, 2, buy, "99", 5);
+    updates = Depth(book);
+    CHECK(updates.size() == 1 && IsUpdate(updates[0], 2, DepthAction::Update, Side::Buy, px("99"), 15));
+
+    Rest(book, 3, sell, "100", 8);
+    updates = Depth(book);
+    CHECK(updates.size() == 1 && IsUpdate(updates[0], 3, DepthAction::Add, Side::Sell, px("100"), 8));
+
+    // The aggressor rests at 100 and fills completely within the same command, so only the
+    // ask it removed is published.
+    Run(book, NewOrder(4, buy, gtf, "100", 8));
+    updates = Depth(book);
+    CHECK(updates.size() == 1 && IsUpdate(updates[0], 4, DepthAction::Delete, Side::Sell, px("100"), 0));
+
+    Run(book, CancelOrder(1));
+    updates = Depth(book);
+    CHECK(updates.size() == 1 && IsUpdate(updates[0], 5, DepthAction::Update, Side::Buy, px("99"), 5));
+
+    Run(book, CancelOrder(1));
+    CHECK(Depth(book).empty());
+
+    BookLevels levels = book.GetBookLevels(5);
+    CHECK(levels.getSequence() == 5);
+    CHECK(levels.getBids().size() == 1 && levels.getBids()[0].price == px("99") && levels.getBids()[0].quantity == 5);
+    CHECK(levels.getAsks().empty());
+}
+
+bool SameLevels(const priceLevels& a, const priceLevels& b){
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const PriceLevel& x, const PriceLevel& y){
+        return x.price == y.price && x.quantity == y.quantity;
+    });
+}
+
+// A book rebuilt from a snapshot plus the journal after it must hold the same levels and the
+// same queue order as the book that wrote them.
+void TestJournalRecovery(){
+    char dir[] = "/tmp/orderbook_test_XXXXXX";
+    if(::mkdtemp(dir) == nullptr){
+        std::cout << "Could not create a temporary directory\n";
+        failures++;
+        return;
+    }
+    std::string journalPath = std::string(dir) + "/journal";
+    std::string snapshotPath = std::string(dir) + "/snapshot";
+    ReplayOptions recovery;
+    recovery.journalPath = journalPath.c_str();
+    recovery.snapshotPath = snapshotPath.c_str();
+
+    Orderbook original;
+    {
+        Journal journal;
+        CHECK(journal.open(journalPath.c_str()));
+        original.AttachJournal(&journal);
+        Rest(original, 1, sell, "100", 10);
+        Rest(original, 2, sell, "100", 5);
+        Rest(original, 3, buy, "99", 7);
+        Run(original, NewOrder(4, buy, gtf, "100", 3));
+        journal.commit();
+        CHECK(original.SaveSnapshot(snapshotPath.c_str(), journal.getSequence()));
+        Rest(original, 5, sell, "101", 4);
+        Run(original, ReplaceOrder(3, 6, "99", 9));
+        Run(original, CancelOrder(2));
+        Rest(original, 7, sell, "100", 2);
+        CHECK(journal.getSequence() == 8);
+        original.AttachJournal(nullptr);
+    }
+
+    // A torn record at the tail is cut off when the journal is opened again.
+    {
+        std::ofstream torn(journalPath, std::ios::binary | std::ios::app);
+        torn << "partial";
+    }
+
+    Orderbook restored;
+    Journal journal;
+    CHECK(Recover(restored, journal, recovery));
+    CHECK(journal.getSequence() == 8);
+    CHECK(restored.getOrderCount() == original.getOrderCount());
+    BookLevels want = original.GetBookLevels(10);
+    BookLevels got = restored.GetBookLevels(10);
+    CHECK(SameLevels(got.getBids(), want.getBids()));
+    CHECK(SameLevels(got.getAsks(), want.getAsks()));
+    restored.AttachJournal(nullptr);
+
+    // Appends far outrun a two-record group, so they wait on the flusher instead of
+    // piling up, and every record still lands in order.
+    {
+        std::string boundedPath = std::string(dir) + "/bounded";
+        OrderCommand command;
+        CHECK(DecodeFix(NewOrder(1, buy, gtf, "100", 1), command) == RejectReason::None);
+        Journal bounded(2, 100);
+        CHECK(bounded.append(command) == 0);
+        CHECK(bounded.open(boundedPath.c_str()));
+        for(uint32 i = 1; i <= 5000; i++){
+            command.orderId = i;
+            CHECK(bounded.append(command) == i);
+        }
+        CHECK(bounded.commit());
+        bounded.close();
+        uint64 next = 1;
+        Journal::Replay(boundedPath.c_str(), 0, [&](uint64 sequence, const OrderCommand& command){
+            CHECK(sequence == next && command.orderId == next);
+            next++;
+        });
+        CHECK(next == 5001);
+        std::remove(boundedPath.c_str());
+    }
+
+    std::string sweep = NewOrder(8, buy, gtf, "101", 20);
+    std::vector<ExecutionReport> expected = Run(original, sweep);
+    std::vector<ExecutionReport> reports = Run(restored, sweep);
+    CHECK(reports.size() == expected.size());
+    for(size_t i = 0; i < std::min(reports.size(), expected.size()); i++){
+        CHECK(reports[i].type == expected[i].type && reports[i].orderId == expected[i].orderId && reports[i].quantity == expected[i].quantity);
+    }
+
+    {
+        std::fstream corrupt(snapshotPath, std::ios::binary | std::ios::in | std::ios::out);
+        corrupt.seekp(Orderbook::snapshotHeaderSize);
+        corrupt.put('\xff');
+    }
+    Orderbook rejected;
+    uint64 journalSeq = 0;
+    CHECK(!rejected.LoadSnapshot(snapshotPath.c_str(), journalSeq));
+    CHECK(rejected.getOrderCount() == 0);
+
+    journal.close();
+    std::remove(journalPath.c_str());
+    std::remove(snapshotPath.c_str());
+    ::rmdir(dir);
+}
+
+// Trades spilled to disk must read back exactly: every query over a store that has spilled
+// most of its history agrees with a brute force pass over the same trades.
+void TestTradeStore(){
+    char path[] = "/tmp/orderbook_trades_XXXXXX";
+    int fd = ::mkstemp(path);
+    CHECK(fd >= 0);
+    ::close(fd);
+
+    TradeStore store(16);
+    CHECK(store.spillTo(path));
+    std::vector<Trade> trades;
+    uint32 seed = 12345;
+    auto next = [&](){ seed = seed * 1103515245 + 12345; return seed >> 8; };
+    for(uint32 i = 0; i < 203; i++){
+        Trade trade{1000 + i * 7 + next() % 5, static_cast<Tick>(390 + next() % 20), 1 + next() % 50, i * 2 + 1, i * 2 + 2, next() % 2 ? Side::Buy : Side::Sell};
+        store.record(trade.time, trade.price, trade.quantity, trade.buyOrderId, trade.sellOrderId, trade.aggressor);
+        trades.push_back(trade);
+        // Spilling runs on its own thread; waiting here keeps a quarter from being dropped
+        // because the previous one is still being written.
+        store.flush();
+    }
+    CHECK(store.getDropped() == 0);
+    CHECK(store.getResident() + store.getSpilled() == trades.size());
+    CHECK(store.getSpilled() > store.getResident());
+
+    std::vector<Trade> all;
+    store.forEach(TradeQuery{}, [&](const Trade& trade){ all.push_back(trade); });
+    CHECK(all.size() == trades.size());
+    for(size_t i = 0; i < std::min(all.size(), trades.size()); i++){
+        CHECK(all[i].time == trades[i].time && all[i].price == trades[i].price && all[i].quantity == trades[i].quantity
+            && all[i].buyOrderId == trades[i].buyOrderId && all[i].sellOrderId == trades[i].sellOrderId && all[i].aggressor == trades[i].aggressor);
+    }
+
+    std::vector<TradeQuery> queries(4);
+    queries[1].fromTime = 1300;
+    queries[1].toTime = 2100;
+    queries[2].lowPrice = 395;
+    queries[2].highPrice = 400;
+    queries[3].fromTime = 1500;
+    queries[3].lowPrice = 400;
+    for(const TradeQuery& query : queries){
+        TradeSummary want;
+        std::map<Tick, uint32> volume;
+        for(const Trade& trade : trades){
+            if(trade.time >= query.fromTime && trade.time <= query.toTime && trade.price >= query.lowPrice && trade.price <= query.highPrice){
+                want.trades++;
+                want.volume += trade.quantity;
+                want.notional += static_cast<int64>(trade.price) * trade.quantity;
+                volume[trade.price] += trade.quantity;
+            }
+        }
+        TradeSummary got = store.summarise(query);
+        CHECK(got.trades == want.trades && got.volume == want.volume && got.notional == want.notional);
+        std::vector<PriceLevel> levels = store.volumeByPrice(query);
+        CHECK(levels.size() == volume.size());
+        auto it = volume.begin();
+        for(size_t i = 0; i < levels.size() && it != volume.end(); i++, it++){
+            CHECK(levels[i].price == it -> first && levels[i].quantity == it -> second);
+        }
+    }
+
+    // Without a spill file the oldest trades are dropped a block at a time.
+    TradeStore bounded(16);
+    for(const Trade& trade : trades){
+        bounded.record(trade.time, trade.price, trade.quantity, trade.buyOrderId, trade.sellOrderId, trade.aggressor);
+    }
+    CHECK(bounded.getSpilled() == 0);
+    CHECK(bounded.getResident() + bounded.getDropped() == trades.size());
+    CHECK(bounded.getResident() <= 16);
+    CHECK(bounded.summarise(TradeQuery{}).trades == bounded.getResident());
+
+    // Recording flat out may outrun the spill thread. Whatever it keeps has to be an in-order
+    // subset of what was recorded, with the rest counted as dropped.
+    TradeStore racing(16);
+    CHECK(racing.spillTo(path));
+    for(const Trade& trade : trades){
+        racing.record(trade.time, trade.price, trade.quantity, trade.buyOrderId, trade.sellOrderId, trade.aggressor);
+    }
+    std::vector<Trade> kept;
+    racing.forEach(TradeQuery{}, [&](const Trade& trade){ kept.push_back(trade); });
+    CHECK(kept.size() + racing.getDropped() == trades.size());
+    CHECK(kept.size() == racing.getResident() + racing.getSpilled());
+    size_t at = 0;
+    for(const Trade& trade : kept){
+        while(at < trades.size() && trades[at].buyOrderId != trade.buyOrderId){
+            at++;
+        }
+        CHECK(at < trades.size() && trades[at].time == trade.time && trades[at].quantity == trade.quantity);
+    }
+    std::remove(path);
+}
+
+// FillOrKill and ImmediateOrCancel never rest: a FillOrKill trades completely or not at all,
+// an ImmediateOrCancel trades what it can reach and kills the rest.
+void TestFillOrKillAndImmediateOrCancel(){
+    Orderbook book;
+    Rest(book, 1, sell, "100", 5);
+    Rest(book, 2, sell, "101", 5);
+    Expect("FOK larger than the reachable depth", book, NewOrder(3, buy, fok, "101", 12), {
+        {ExecType::Ack, 3, px("101"), 12, 12},
+        {ExecType::Kill, 3, px("101"), 12, 12}});
+    CHECK(book.getOrderCount() == 2);
+    Expect("FOK across two levels", book, NewOrder(4, buy, fok, "101", 8), {
+        {ExecType::Ack, 4, px("101"), 8, 8},
+        {ExecType::Fill, 4, px("100"), 5, 3},
+        {ExecType::Fill, 1, px("100"), 5, 0},
+        {ExecType::Fill, 4, px("101"), 3, 0},
+        {ExecType::Fill, 2, px("101"), 3, 2}});
+
+    Expect("IOC with nothing to trade", book, NewOrder(5, sell, ioc, "100", 4), {
+        {ExecType::Ack, 5, px("100"), 4, 4},
+        {ExecType::Kill, 5, px("100"), 4, 4}});
+    Rest(book, 6, buy, "99", 3);
+    Expect("IOC partial fill", book, NewOrder(7, sell, ioc, "99", 5), {
+        {ExecType::Ack, 7, px("99"), 5, 5},
+        {ExecType::Fill, 6, px("99"), 3, 0},
+        {ExecType::Fill, 7, px("99"), 3, 2},
+        {ExecType::Kill, 7, px("99"), 5, 2}});
+    CHECK(book.getOrderCount() == 1);
+}
+
+bool SameCommand(const OrderCommand& a, const OrderCommand& b){
+    return a.type == b.type && a.orderType == b.orderType && a.side == b.side && a.orderId == b.orderId && a.origOrderId == b.origOrderId
+        && a.price == b.price && a.quantity == b.quantity && a.symbol.view() == b.symbol.view();
+}
+
+// Every command FIX can express survives EncodeBinary/DecodeBinary unchanged and drives the
+// book to the same reports, and malformed frames are rejected by the header checks.
+void TestBinaryRoundTrip(){
+    std::vector<std::string> messages = {
+        NewOrder(1, sell, gtf, "100.25", 10),
+        NewOrder(2, buy, fok, "100.25", 4),
+        NewOrderOn("NQ.H5", 3, sell, ioc, "-1.75", 7),
+        ReplaceOrder(1, 4, "100.50", 8),
+        CancelOrder(4),
+    };
+    Orderbook fixBook;
+    Orderbook binaryBook;
+    for(const std::string& msg : messages){
+        OrderCommand command;
+        CHECK(DecodeFix(msg, command) == RejectReason::None);
+        unsigned char frame[binaryMaxMessageSize];
+        size_t size = EncodeBinary(command, frame);
+        CHECK(size <= binaryMaxMessageSize);
+        OrderCommand decoded;
+        CHECK(DecodeBinary(frame, size, decoded) == RejectReason::None);
+        CHECK(SameCommand(command, decoded));
+
+        std::vector<ExecutionReport> want = Run(fixBook, msg);
+        binaryBook.ParseBinary(frame, size);
+        std::vector<ExecutionReport> got;
+        binaryBook.DrainReports([&](const ExecutionReport& report){ got.push_back(report); });
+        CHECK(got.size() == want.size());
+        for(size_t i = 0; i < std::min(got.size(), want.size()); i++){
+            CHECK(got[i].type == want[i].type && got[i].orderId == want[i].orderId && got[i].price == want[i].price
+                && got[i].quantity == want[i].quantity && got[i].leaves == want[i].leaves);
+        }
+    }
+
+    OrderCommand command;
+    CHECK(DecodeFix(NewOrder(5, buy, gtf, "99", 1), command) == RejectReason::None);
+    unsigned char frame[binaryMaxMessageSize];
+    size_t size = EncodeBinary(command, frame);
+    OrderCommand decoded;
+    CHECK(DecodeBinary(frame, size - 1, decoded) == RejectReason::BadBodyLength);
+    CHECK(DecodeBinary(frame, 4, decoded) == RejectReason::BadBodyLength);
+    // A header that declares a block too short for the order id must not read past it.
+    for(uint16_t blockLength : {0, 2, 3}){
+        std::vector<unsigned char> shortFrame(frame, frame + binaryHeaderSize);
+        putLE(shortFrame.data(), blockLength, 2);
+        shortFrame.resize(binaryHeaderSize + blockLength, 0xff);
+        OrderCommand truncated;
+        CHECK(DecodeBinary(shortFrame.data(), shortFrame.size(), truncated) == RejectReason::BadBodyLength);
+        CHECK(truncated.orderId == 0);
+    }
+    frame[4] = 9;
+    CHECK(DecodeBinary(frame, size, decoded) == RejectReason::UnsupportedMsgType);
+    frame[4] = binarySchemaId;
+    frame[2] = 7;
+    CHECK(DecodeBinary(frame, size, decoded) == RejectReason::UnsupportedMsgType);
+    frame[2] = binaryNewOrder;
+    frame[binaryHeaderSize + 12] = 3;
+    CHECK(DecodeBinary(frame, size, decoded) == RejectReason::InvalidSide);
+    frame[binaryHeaderSize + 12] = 1;
+    std::memset(frame + binaryHeaderSize + 16, 'X', 16);
+    CHECK(DecodeBinary(frame, size, decoded) == RejectReason::InvalidSymbol);
+}
+
+// Stops wait off the book until a trade reaches their stop price. A stop-limit then enters as
+// a limit order, a stop as a market order that kills whatever it can not fill.
+void TestStops(){
+    Orderbook book;
+    Rest(book, 1, sell, "100", 5);
+    Rest(book, 2, sell, "101", 5);
+    Rest(book, 3, buy, "98", 5);
+    Expect("stop-limit", book, StopOrder(10, buy, "4", "100", "101", 3), {{ExecType::Ack, 10, px("101"), 3, 3}});
+    Expect("stop", book, StopOrder(11, buy, "3", "101", "", 4), {{ExecType::Ack, 11, px("101"), 4, 4}});
+    CHECK(book.getOrderCount() == 3 && book.getStopCount() == 2);
+
+    Expect("trade at 100 triggers the stop-limit only", book, NewOrder(12, buy, gtf, "100", 2), {
+        {ExecType::Ack, 12, px("100"), 2, 2},
+        {ExecType::Fill, 12, px("100"), 2, 0},
+        {ExecType::Fill, 1, px("100"), 2, 3},
+        {ExecType::Trigger, 10, px("100"), 3, 3},
+        {ExecType::Fill, 10, px("100"), 3, 0},
+        {ExecType::Fill, 1, px("100"), 3, 0}});
+    CHECK(book.getStopCount() == 1);
+    Expect("cancel a waiting stop", book, CancelOrder(11), {{ExecType::Cancel, 11, px("101"), 4, 4}});
+    CHECK(book.getStopCount() == 0);
+
+    Expect("sell stop", book, StopOrder(13, sell, "3", "99", "", 9), {{ExecType::Ack, 13, px("99"), 9, 9}});
+    Rest(book, 14, sell, "99", 1);
+    std::vector<ExecutionReport> reports = Run(book, NewOrder(15, buy, gtf, "99", 1));
+    CHECK(reports.size() == 7);
+    if(reports.size() == 7){
+        CHECK(reports[3].type == ExecType::Trigger && reports[3].orderId == 13 && reports[3].price == px("99"));
+        CHECK(reports[4].type == ExecType::Fill && reports[4].orderId == 3 && reports[4].price == px("98") && reports[4].quantity == 5);
+        CHECK(reports[5].type == ExecType::Fill && reports[5].orderId == 13 && reports[5].quantity == 5 && reports[5].leaves == 4);
+        CHECK(reports[6].type == ExecType::Kill && reports[6].orderId == 13 && reports[6].price == px("99") && reports[6].leaves == 4);
+    }
+    CHECK(book.getOrderCount() == 1);
+
+    Orderbook thin;
+    Rest(thin, 1, sell, "100", 1);
+    Expect("stop", thin, StopOrder(2, buy, "3", "100", "", 3), {{ExecType::Ack, 2, px("100"), 3, 3}});
+    Expect("a stop with nothing left to take is killed at its stop price", thin, NewOrder(3, buy, gtf, "100", 1), {
+        {ExecType::Ack, 3, px("100"), 1, 1},
+        {ExecType::Fill, 3, px("100"), 1, 0},
+        {ExecType::Fill, 1, px("100"), 1, 0},
+        {ExecType::Trigger, 2, px("100"), 3, 3},
+        {ExecType::Kill, 2, px("100"), 3, 3}});
+}
+
+// 35=q cancels by side, by price range (6000/6001) and, with 530=6, only the sending
+// session's (49) orders, stops included, and answers with one MassCancel report carrying
+// the number of orders and the open quantity it removed.
+void TestMassCancel(){
+    Orderbook book;
+    Rest(book, 1, buy, "99", 5, "49=A|");
+    Rest(book, 2, buy, "98", 3, "49=B|");
+    Rest(book, 3, sell, "101", 4, "49=A|");
+    Rest(book, 4, sell, "103", 6, "49=B|");
+    Expect("stop", book, StopOrder(5, buy, "3", "104", "", 2), {{ExecType::Ack, 5, px("104"), 2, 2}});
+
+    Expect("sells from 102 up", book, Fix("35=q|11=100|530=7|55=ES|54=2|6000=102|"), {{ExecType::MassCancel, 100, 0, 1, 6}});
+    Expect("own session", book, Fix("35=q|11=101|530=6|55=ES|49=A|"), {{ExecType::MassCancel, 101, 0, 2, 9}});
+    CHECK(book.getOrderCount() == 1 && book.getStopCount() == 1);
+    Expect("nothing left in range", book, Fix("35=q|11=102|530=7|55=ES|6000=100|6001=102|"), {{ExecType::MassCancel, 102, 0, 0, 0}});
+    Expect("everything else", book, Fix("35=q|11=103|530=7|55=ES|"), {{ExecType::MassCancel, 103, 0, 2, 5}});
+    CHECK(book.getOrderCount() == 0 && book.getStopCount() == 0);
+    Expect("cancelled ids are gone", book, CancelOrder(2), {{ExecType::Reject, 2, 0, 0, 0, RejectReason::UnknownOrderId}});
+    Rest(book, 1, buy, "99", 5);
+}
+
+// A sweep raises more reports and depth deltas than the rings hold. Without sinks the
+// overflow is counted and dropped; with them every event arrives, in order.
+void TestRingOverflow(){
+    for(bool sinks : {false, true}){
+        Orderbook book(1024, 4);
+        std::vector<ExecutionReport> reports;
+        std::vector<DepthUpdate> updates;
+        auto report = [&](const ExecutionReport& r){ reports.push_back(r); };
+        auto update = [&](const DepthUpdate& u){ updates.push_back(u); };
+        for(uint32 i = 0; i < 5; i++){
+            Rest(book, i + 1, sell, std::to_string(100 + i), 1);
+            Depth(book);
+        }
+        if(sinks){
+            book.setReportSink(report);
+            book.setDepthSink(update);
+        }
+        book.ParseMessage(NewOrder(6, buy, gtf, "104", 5));
+        book.DrainReports(report);
+        book.DrainDepth(update);
+        if(!sinks){
+            CHECK(reports.size() == 4 && updates.size() == 4);
+            CHECK(book.getDroppedReports() == 7 && book.getDroppedDepth() == 1);
+            continue;
+        }
+        CHECK(book.getDroppedReports() == 0 && book.getDroppedDepth() == 0);
+        CHECK(reports.size() == 11 && updates.size() == 5);
+        for(size_t i = 0; reports.size() == 11 && i < 5; i++){
+            CHECK(reports[1 + 2 * i].orderId == 6 && reports[2 + 2 * i].orderId == i + 1);
+            CHECK(reports[2 + 2 * i].price == px(std::to_string(100 + i)));
+        }
+        for(size_t i = 1; i < updates.size(); i++){
+            CHECK(updates[i].sequence == updates[i - 1].sequence + 1);
+        }
+        std::ostringstream out;
+        book.getStats().Print(out);
+        CHECK(out.str().find("Dropped reports: 0  Dropped depth: 0") != std::string::npos);
+    }
+}
+
+// A contract prices its book in its own ticks and rejects orders outside its band or above
+// its maximum size before they reach the book.
+void TestContractSpec(){
+    ContractSpec zn;
+    CHECK(parseContract("ZN:tick=0.015625,low=100,high=130,max=5000", zn));
+    CHECK(zn.ticksPerPoint == 64 && zn.lowBand == 6400 && zn.highBand == 8320 && zn.maxQuantity == 5000);
+    CHECK(zn.orderCapacity == 0 && zn.bookCapacity(100) == 100);
+    ContractSpec sized;
+    CHECK(parseContract("ZN:orders=5000", sized) && sized.bookCapacity(100) == 5000);
+    char text[32];
+    CHECK(zn.format(7041, text) == "110.015625");
+    CHECK(zn.format(-7040, text) == "-110");
+    ContractSpec bad;
+    CHECK(!parseContract("ZN:tick=0.3", bad));
+    CHECK(!parseContract("ZN:low=130,high=100", bad));
+    CHECK(!parseContract("ZN:size=5", bad));
+    CHECK(!parseContract(":tick=0.25", bad));
+    CHECK(!parseContract("ZN:orders=0", bad));
+
+    Orderbook book;
+    book.setContract(zn);
+    Expect("1/64 tick", book, NewOrderOn("ZN", 1, buy, gtf, "110.015625", 10), {{ExecType::Ack, 1, 7041, 10, 10}});
+    Expect("off the tick", book, NewOrderOn("ZN", 2, buy, gtf, "110.01", 10), {{ExecType::Reject, 2, 0, 0, 0, RejectReason::InvalidPrice}});
+    Expect("above the band", book, NewOrderOn("ZN", 3, sell, gtf, "131", 1), {{ExecType::Reject, 3, 8384, 1, 1, RejectReason::PriceOutsideBand}});
+    Expect("too large", book, NewOrderOn("ZN", 4, sell, gtf, "110", 6000), {{ExecType::Reject, 4, 7040, 6000, 6000, RejectReason::QuantityTooLarge}});
+    Expect("at the limits", book, NewOrderOn("ZN", 5, sell, gtf, "130", 5000), {{ExecType::Ack, 5, 8320, 5000, 5000}});
+    CHECK(book.getOrderCount() == 2);
+}
+
+Orderbook& WithRisk(Orderbook& book, std::string_view spec){
+    RiskLimits limits;
+    if(!RiskLimits::parse(spec, limits)){
+        std::cout << "Bad test risk limits " << spec << "\n";
+        failures++;
+    }
+    book.setRiskLimits(limits);
+    return book;
+}
+
+// Session A's buy meets its own resting sell ahead of session B's in each self-trade mode.
+void TestSelfTradePrevention(){
+    {
+        Orderbook book;
+        WithRisk(book, "stp=cancel-resting");
+        Rest(book, 1, sell, "100", 5, "49=A|");
+        Rest(book, 2, sell, "100", 5, "49=B|");
+        Expect("cancel resting", book, NewOrder(3, buy, gtf, "100", 7, "49=A|"), {
+            {ExecType::Ack, 3, px("100"), 7, 7},
+            {ExecType::SelfTrade, 1, px("100"), 5, 0},
+            {ExecType::Fill, 3, px("100"), 5, 2},
+            {ExecType::Fill, 2, px("100"), 5, 0}});
+        CHECK(book.getOrderCount() == 1);
+    }
+    {
+        Orderbook book;
+        WithRisk(book, "stp=cancel-aggressor");
+        Rest(book, 1, sell, "100", 5, "49=A|");
+        Rest(book, 2, sell, "100", 5, "49=B|");
+        Expect("cancel aggressor", book, NewOrder(3, buy, gtf, "100", 7, "49=A|"), {
+            {ExecType::Ack, 3, px("100"), 7, 7},
+            {ExecType::SelfTrade, 3, px("100"), 7, 0}});
+        CHECK(book.getOrderCount() == 2);
+    }
+    {
+        Orderbook book;
+        WithRisk(book, "stp=decrement");
+        Rest(book, 1, sell, "100", 5, "49=A|");
+        Rest(book, 2, sell, "100", 5, "49=B|");
+        Expect("decrement both", book, NewOrder(3, buy, gtf, "100", 7, "49=A|"), {
+            {ExecType::Ack, 3, px("100"), 7, 7},
+            {ExecType::SelfTrade, 1, px("100"), 5, 0},
+            {ExecType::SelfTrade, 3, px("100"), 5, 2},
+            {ExecType::Fill, 3, px("100"), 2, 0},
+            {ExecType::Fill, 2, px("100"), 2, 3}});
+        CHECK(book.getOrderCount() == 1);
+    }
+}
+
+void TestRiskLimits(){
+    RiskLimits limits;
+    CHECK(!RiskLimits::parse("stp=sometimes", limits));
+    CHECK(!RiskLimits::parse("size", limits));
+    CHECK(!RiskLimits::parse("depth=3", limits));
+
+    Orderbook book;
+    WithRisk(book, "size=10,open=15,distance=8");
+    Expect("order size", book, NewOrder(1, sell, gtf, "100", 11, "49=A|"), {{ExecType::Reject, 1, px("100"), 11, 11, RejectReason::RiskOrderSize}});
+    Rest(book, 2, sell, "100", 10, "49=A|");
+    Expect("open quantity", book, NewOrder(3, sell, gtf, "101", 6, "49=A|"), {{ExecType::Reject, 3, px("101"), 6, 6, RejectReason::RiskOpenQuantity}});
+    Rest(book, 4, sell, "101", 6, "49=B|");
+    Expect("nine ticks through", book, NewOrder(5, buy, gtf, "102.25", 1, "49=B|"), {{ExecType::Reject, 5, px("102.25"), 1, 1, RejectReason::RiskPriceDistance}});
+    Expect("eight ticks through", book, NewOrder(6, buy, gtf, "102", 1, "49=B|"), {
+        {ExecType::Ack, 6, px("102"), 1, 1},
+        {ExecType::Fill, 6, px("100"), 1, 0},
+        {ExecType::Fill, 2, px("100"), 1, 9}});
+}
+
+// Quantity self-trade prevention would remove does not count towards a FillOrKill, and a
+// level emptied only by self-trade prevention is not a trade, so it triggers no stops.
+void TestSelfTradeFillOrKillAndStops(){
+    Orderbook book;
+    WithRisk(book, "stp=cancel-resting");
+    Rest(book, 1, sell, "100", 5, "49=A|");
+    Rest(book, 2, sell, "100", 3, "49=B|");
+    Expect("FOK short once own orders are left out", book, NewOrder(3, buy, fok, "100", 5, "49=A|"), {
+        {ExecType::Ack, 3, px("100"), 5, 5},
+        {ExecType::Kill, 3, px("100"), 5, 5}});
+    CHECK(book.getOrderCount() == 2);
+
+    Orderbook stops;
+    WithRisk(stops, "stp=cancel-resting");
+    Rest(stops, 1, sell, "100", 5, "49=A|");
+    Expect("stop", stops, StopOrder(2, buy, "3", "100", "", 1), {{ExecType::Ack, 2, px("100"), 1, 1}});
+    Expect("self-trade only", stops, NewOrder(3, buy, gtf, "100", 5, "49=A|"), {
+        {ExecType::Ack, 3, px("100"), 5, 5},
+        {ExecType::SelfTrade, 1, px("100"), 5, 0}});
+    CHECK(stops.getStopCount() == 1 && stops.getOrderCount() == 1);
+}
+
+std::string KillText(Orderbook& book, std::string_view msg){
+    std::ostringstream out;
+    for(const ExecutionReport& report : Run(book, msg)){
+        if(report.type == ExecType::Kill){
+            PrintReport(report, out);
+        }
+    }
+    return out.str();
+}
+
+// Kill reports name the order type that was killed.
+void TestKillNames(){
+    Orderbook book;
+    Rest(book, 1, buy, "99", 2);
+    CHECK(KillText(book, NewOrder(2, sell, fok, "99", 5)) == "FillorKill Order# 2 could not be filled so it was cancelled.\n");
+    CHECK(KillText(book, NewOrder(3, sell, ioc, "99", 5)) == "ImmediateOrCancel Order# 3 was killed with 3 units unfilled.\n");
+    Rest(book, 4, sell, "100", 1);
+    Expect("stop", book, StopOrder(5, buy, "3", "100", "", 3), {{ExecType::Ack, 5, px("100"), 3, 3}});
+    CHECK(KillText(book, NewOrder(6, buy, gtf, "100", 1)) == "Stop Order# 5 could not be filled so it was cancelled.\n");
+}
+
+}
+
+int main(){
+    TestFixValidation();
+    TestParseTicks();
+    TestCancelReplace();
+    TestDepthConflation();
+    TestJournalRecovery();
+    TestTradeStore();
+    TestFillOrKillAndImmediateOrCancel();
+    TestBinaryRoundTrip();
+    TestStops();
+    TestMassCancel();
+    TestRingOverflow();
+    TestContractSpec();
+    TestSelfTradePrevention();
+    TestRiskLimits();
+    TestSelfTradeFillOrKillAndStops();
+    TestKillNames();
+    TestMatchingEngineRouting();
+    if(failures != 0){
+        std::cout << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "All orderbook tests passed\n";
+    return 0;
+}